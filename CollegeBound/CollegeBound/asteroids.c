@@ -129,11 +129,15 @@ static wall *walls = NULL;
 
 static xGroupHandle astGroup;
 static xGroupHandle wallGroup;
+
+// Registered image IDs
+static xImageHandle mapImage, shipImage, bulletImage, astImage;
+static xImageHandle widthWallImage, sideWallImage, wallImage, smallWallImage, blockWallImage;
 static xSpriteHandle background;
 
 void init(void);
 void reset(void);
-wall *createWall(char * image, float x, float y, int16_t angle, wall *nxt, float height, float width);
+wall *createWall(xImageHandle image, float x, float y, int16_t angle, wall *nxt, float height, float width);
 object *createBullet(float x, float y, float velx, float vely, object *nxt);
 
 //void controllerTask(void *vParam) {
@@ -542,7 +546,6 @@ int main(void) {
 	xTaskCreate(bulletTask, (signed char *) "b", 250, NULL, 2, &bulletTaskHandle);
 	xTaskCreate(updateTask, (signed char *) "u", 200, NULL, 4, &updateTaskHandle);
 	xTaskCreate(drawTask, (signed char *) "d", 600, NULL, 3, NULL);
-	xTaskCreate(USART_Write_Task, (signed char *) "w", 200, NULL, 5, NULL);
 	
 	vTaskStartScheduler();
 	
@@ -561,7 +564,17 @@ void init(void) {
 	bullets = NULL;
 	wallGroup = ERROR_HANDLE;
 	
-	background = xSpriteCreate("map.png", SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W, SCREEN_H, 0);
+	mapImage = xImageRegister("map.png");
+	shipImage = xImageRegister("ship.png");
+	bulletImage = xImageRegister("bullet.png");
+	astImage = xImageRegister("ast1.png");
+	widthWallImage = xImageRegister("width_wall.bmp");
+	sideWallImage = xImageRegister("side_wall.bmp");
+	wallImage = xImageRegister("wall.bmp");
+	smallWallImage = xImageRegister("small_wall.bmp");
+	blockWallImage = xImageRegister("block_wall.bmp");
+	
+	background = xSpriteCreate(mapImage, SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W, SCREEN_H, 0);
 	
 	srand(TCNT0);
 	
@@ -580,7 +593,7 @@ void init(void) {
 	//}
 	
 	ship.handle = xSpriteCreate(
-      "ship.png", 
+      shipImage, 
       SHIP_SIZE * 3,
       SHIP_SIZE * 3, 
       0, 
@@ -597,7 +610,7 @@ void init(void) {
 	ship.a_vel = 0;
 	
 	createWall(
-	   "width_wall.bmp",
+	   widthWallImage,
 	   SCREEN_W >> 1,
 	   0,
 	   0,
@@ -606,7 +619,7 @@ void init(void) {
       WALL_WIDTH);
    
    createWall(
-      "width_wall.bmp",
+      widthWallImage,
       SCREEN_W >> 1,
       SCREEN_H,
       0,
@@ -615,7 +628,7 @@ void init(void) {
       WALL_WIDTH);
    
 	createWall(
-      "side_wall.bmp",
+      sideWallImage,
       0, 
       SCREEN_H >> 1, 
       0, 
@@ -624,7 +637,7 @@ void init(void) {
       1);
       
    createWall(
-      "side_wall.bmp",
+      sideWallImage,
       SCREEN_W,
       SCREEN_H >> 1,
       0,
@@ -633,7 +646,7 @@ void init(void) {
       1);
       
    walls = createWall(
-      "wall.bmp",
+      wallImage,
       SCREEN_W >> 1,
       SCREEN_H >> 1,
       0,
@@ -642,7 +655,7 @@ void init(void) {
       1);
       
    walls = createWall(
-      "small_wall.bmp",
+      smallWallImage,
       SCREEN_W - 2.5 * WALL_SIZE,
       SCREEN_H >> 2,
       0,
@@ -651,7 +664,7 @@ void init(void) {
       4);
       
    walls = createWall(
-      "small_wall.bmp",
+      smallWallImage,
       2.5 * WALL_SIZE,
       SCREEN_H - (SCREEN_H >> 2),
       0,
@@ -660,7 +673,7 @@ void init(void) {
       4);
       
    walls = createWall(
-      "block_wall.bmp",
+      blockWallImage,
       SCREEN_W - 4.5 * WALL_SIZE,
       SCREEN_H - 1.5 * WALL_SIZE,
       0,
@@ -669,7 +682,7 @@ void init(void) {
       WALL_BLOCK);
       
    walls = createWall(
-      "block_wall.bmp",
+      blockWallImage,
       4.5 * WALL_SIZE,
       1.5 * WALL_SIZE,
       0,
@@ -734,13 +747,13 @@ void reset(void) {
    vSpriteDelete(background);
 }
 
-wall *createWall(char *image, float x, float y, int16_t angle, wall *nxt, float height, float width) {
+wall *createWall(xImageHandle image, float x, float y, int16_t angle, wall *nxt, float height, float width) {
    //allocate space for a new wall
    wall *newWall = pvPortMalloc(sizeof(wall));
    
    //setup wall sprite
    newWall->handle = xSpriteCreate(
-      image,                  //reference to png filename
+      image,                  //registered image ID
       x,                      //xPos
       y,                      //yPos
       angle,                  //rAngle
@@ -751,11 +764,11 @@ wall *createWall(char *image, float x, float y, int16_t angle, wall *nxt, float
    //set positions
    newWall->topLeft.x = 1 + x - ((width / 2) * WALL_SIZE);
    newWall->topLeft.y = 1 + y - ((height / 2) * WALL_SIZE);
-   xSpriteCreate("ast1.png", newWall->topLeft.x, newWall->topLeft.y, 0, SHIP_SIZE, SHIP_SIZE, 15);
+   xSpriteCreate(astImage, newWall->topLeft.x, newWall->topLeft.y, 0, SHIP_SIZE, SHIP_SIZE, 15);
    
    newWall->botRight.x = x + ((width / 2) * WALL_SIZE);
    newWall->botRight.y = y + ((height / 2) * WALL_SIZE);
-   xSpriteCreate("bullet.png", newWall->botRight.x, newWall->botRight.y, 0, SHIP_SIZE, SHIP_SIZE, 16);
+   xSpriteCreate(bulletImage, newWall->botRight.x, newWall->botRight.y, 0, SHIP_SIZE, SHIP_SIZE, 16);
    //set angle
    newWall->angle = angle;
    //link to asteroids list
@@ -885,7 +898,7 @@ object *createBullet(float x, float y, float velx, float vely, object *nxt) {
 	//Setup the pointers in the linked list
 	//Create a new sprite using xSpriteCreate()
 	newBullet->handle = xSpriteCreate(
-	"bullet.png",			//reference to png filename
+	bulletImage,			//registered image ID
 	x,                   //xPos
 	y,                   //yPos
 	ship.angle,          //rAngle
@@ -48,32 +48,21 @@
 #include "snes.h"
 
 // Array of tank sprite image names
-const char* tank_images[] = {
+const char* tank_image_files[] = {
    "tank0.png",
    "tank1.png",
    "tank2.png",
    "tank3.png"};
 
 // Array of bullet sprite image names
-const char* bullet_images[] = {
+const char* bullet_image_files[] = {
    "bullet0.png",
    "bullet1.png",
    "bullet2.png",
    "bullet3.png"};
 
-// Array of number sprite image names
-const char* num_images[] = {
-   "3.png",
-   "2.png",
-   "1.png"};
-// Array of "round" sprite image names
-const char* round_images[] = {
-   "round1.png",
-   "round2.png",
-   "round3.png"};
-
 // Array of health sprite image names
-const char* health_images1[] = {
+const char* health_image_files1[] = {
    "p1_health5.png",
    "p1_health4.png",
    "p1_health3.png",
@@ -82,13 +71,44 @@ const char* health_images1[] = {
    "health0.png"};
 
 // Array of health sprite image names
-const char* health_images2[] = {
+const char* health_image_files2[] = {
    "p2_health5.png",
    "p2_health4.png",
    "p2_health3.png",
    "p2_health2.png",
    "p2_health1.png",
    "health0.png"};
+
+// Array of screen and banner sprite image names, indexed by the *_IMG defines
+const char* screen_image_files[] = {
+   "map.png",
+   "start_screen.png",
+   "press_start.png",
+   "select_screen.png",
+   "p1.png",
+   "p2.png",
+   "p1_win_round.png",
+   "p2_win_round.png",
+   "p1_win.png",
+   "p2_win.png"};
+
+// Array of wall sprite image names, indexed by the *_WALL_IMG defines
+const char* wall_image_files[] = {
+   "width_wall.bmp",
+   "side_wall.bmp",
+   "wall.bmp",
+   "small_wall.bmp",
+   "block_wall.bmp"};
+
+#define NUM_ARRAY_ELEMS(a) (sizeof(a) / sizeof((a)[0]))
+
+// Registered image IDs for each of the image name arrays above
+static xImageHandle tank_images[NUM_ARRAY_ELEMS(tank_image_files)];
+static xImageHandle bullet_images[NUM_ARRAY_ELEMS(bullet_image_files)];
+static xImageHandle health_images1[NUM_ARRAY_ELEMS(health_image_files1)];
+static xImageHandle health_images2[NUM_ARRAY_ELEMS(health_image_files2)];
+static xImageHandle screen_images[NUM_ARRAY_ELEMS(screen_image_files)];
+static xImageHandle wall_images[NUM_ARRAY_ELEMS(wall_image_files)];
    
 //represents a point on the screen
 typedef struct {
@@ -132,6 +152,7 @@ typedef struct tank_info{
 
 // Game Parameters
 #define FRAME_DELAY_MS  10
+#define FRAMES_PER_SEC  (1000 / FRAME_DELAY_MS)
 #define GAME_RESET_DELAY_MS  2000
 #define CONTROLLER_DELAY_MS 100
 #define NUM_ROUNDS 3
@@ -167,8 +188,12 @@ typedef struct tank_info{
 #define BULLET_SIZE 20
 #define BULLET_DELAY_MS 1000
 #define BULLET_VEL 8.0
+#define BULLET_POOL_SIZE 4
 #define DAMAGE 20
 
+// Collision Parameters
+#define MAX_WALL_CONTACTS 4
+
 // Graphics Parameters
 #define TANK_SIZE 60
 #define TANK_OFFSET TANK_SIZE / 2.0
@@ -176,12 +201,31 @@ typedef struct tank_info{
 #define HEALTH_BAR_OFFSET_P1 20
 #define HEALTH_BAR_OFFSET_P2 SCREEN_W-5 
 #define TANK_SEL_BANNER_SIZE 100
+#define COUNTDOWN_FONT_SIZE 120
+
+// Indices into screen_images
+#define MAP_IMG           0
+#define START_SCREEN_IMG  1
+#define PRESS_START_IMG   2
+#define SELECT_SCREEN_IMG 3
+#define P1_IMG            4
+#define P2_IMG            5
+#define P1_WIN_ROUND_IMG  6
+#define P2_WIN_ROUND_IMG  7
+#define P1_WIN_IMG        8
+#define P2_WIN_IMG        9
+
+// Indices into wall_images
+#define WIDTH_WALL_IMG 0
+#define SIDE_WALL_IMG  1
+#define MID_WALL_IMG   2
+#define SMALL_WALL_IMG 3
+#define BLOCK_WALL_IMG 4
 
 // Task Handlers
 static xTaskHandle input1TaskHandle, input2TaskHandle;
 static xTaskHandle bullet1TaskHandle, bullet2TaskHandle;
 static xTaskHandle update1TaskHandle, update2TaskHandle;
-static xTaskHandle uartTaskHandle;
 
 //Mutex used to protect usart usage
 static xSemaphoreHandle usartMutex;
@@ -214,13 +258,27 @@ uint8_t fire_button2 = 0;
 static xGroupHandle wallGroup;
 static xGroupHandle tankGroup1;
 static xGroupHandle tankGroup2;
+static xGroupHandle bulletGroup1;
+static xGroupHandle bulletGroup2;
+static xSpritePoolHandle bulletPool1;
+static xSpritePoolHandle bulletPool2;
 static xSpriteHandle background;
 static xSpriteHandle health1, health2;
 
+// Walls each tank is currently touching, oldest contact first. Kept up to date
+// by the collision events pushed from the graphics module.
+static xSpriteHandle tank1_walls[MAX_WALL_CONTACTS], tank2_walls[MAX_WALL_CONTACTS];
+static uint8_t tank1_wall_count, tank2_wall_count;
+
 // Function Prototypes
 void init(void);
 void reset(void);
-wall *createWall(char * image, float x, float y, wall *nxt, float height, float width);
+void registerImageArray(const char *files[], xImageHandle images[], uint8_t count);
+void registerImages(void);
+void handleCollision(xCollisionEvent *event, uint8_t *game_status);
+void updateWallContacts(xSpriteHandle contacts[], uint8_t *count, xCollisionEvent *event);
+uint8_t removeBullet(object **bullets, xSpritePoolHandle pool, xSpriteHandle handle);
+wall *createWall(xImageHandle image, float x, float y, wall *nxt, float height, float width);
 object *createBullet(float x, float y, float velx, float vely, uint8_t tank_num, int16_t angle, object *nxt);
 void startup(void);
 void createEnvironment(void);
@@ -322,16 +380,16 @@ void bulletTask(void *vParam) {
 /*------------------------------------------------------------------------------
  * Function: updateTask
  *
- * Description: This task observes the currently stored velocities for every
- *  object element in the passed tank_info struct and updates their position and 
- *  rotation accordingly. It also updates the tank's velocities based on its 
- *  current acceleration and angle. This task runs every 10 milliseconds.
+ * Description: This task observes the currently stored velocities of the tank
+ *  in the passed tank_info struct and updates its position and rotation
+ *  accordingly. It also updates the tank's velocities based on its current
+ *  acceleration and angle. Bullets are moved by the graphics module from the
+ *  velocity they were created with. This task runs every 10 milliseconds.
  *
  * param vParam: This parameter is a pointer to a tank_info struct.
  *----------------------------------------------------------------------------*/
 void updateTask(void *vParam) {
 	float vel;
-	object *objIter, *objPrev;
    tank_info* tank_stuff = (tank_info*)vParam;
    
 	for (;;) {
@@ -383,17 +441,6 @@ void updateTask(void *vParam) {
    		tank_stuff->tank->accel = 0;
    		tank_stuff->tank->a_vel = 0;
 		}
-
-		// move bullets
-		objPrev = NULL;
-		objIter = *(tank_stuff->bullets);
-		while (objIter != NULL) {
-         objIter->pos.x += objIter->vel.x;
-         objIter->pos.y += objIter->vel.y;
-
-         objPrev = objIter;
-         objIter = objIter->next;
-		}
 		
 		vTaskDelay(FRAME_DELAY_MS / portTICK_RATE_MS);
 	}
@@ -412,10 +459,10 @@ void updateTask(void *vParam) {
  * param vParam: This parameter is not used.
  *----------------------------------------------------------------------------*/
 void drawTask(void *vParam) {   
-	object *objIter, *objPrev;
    wall *wallIter, *wallPrev;
 	xSpriteHandle hit, handle;
 	point topLeft, botRight;
+	xCollisionEvent event;
 	uint8_t game_status = IN_PLAY;
 	
 	vTaskSuspend(update1TaskHandle);
@@ -424,6 +471,8 @@ void drawTask(void *vParam) {
    vTaskSuspend(bullet2TaskHandle);
 	vTaskSuspend(input1TaskHandle);
    vTaskSuspend(input2TaskHandle);
+	ulGraphicsNegotiateBaud();
+	registerImages();
 	init();
 	vTaskResume(update1TaskHandle);
    vTaskResume(update2TaskHandle);
@@ -434,7 +483,15 @@ void drawTask(void *vParam) {
    
 	for (;;) {
 		xSemaphoreTake(usartMutex, portMAX_DELAY);
-		if (uCollide(tank1.handle, wallGroup, &hit, 1) > 0) {
+		vFrameBegin();
+		
+		// Apply the contact changes pushed by the graphics module since the
+		// last frame
+		while (xCollisionEventReceive(&event, 0) == pdTRUE)
+		   handleCollision(&event, &game_status);
+		
+		if (tank1_wall_count > 0) {
+		   hit = tank1_walls[0];
    		//find which wall was collided with
          wallPrev = NULL;
    		wallIter = walls;
@@ -471,10 +528,11 @@ void drawTask(void *vParam) {
       }
       
       //adjust tank1
-		vSpriteSetRotation(tank1.handle, (uint16_t)tank1.angle);
-		vSpriteSetPosition(tank1.handle, (uint16_t)tank1.pos.x, (uint16_t)tank1.pos.y);
+		vSpriteSetTransform(tank1.handle, (uint16_t)tank1.pos.x, (uint16_t)tank1.pos.y,
+		 (uint16_t)tank1.angle);
       
-      if (uCollide(tank2.handle, wallGroup, &hit, 1) > 0) {
+      if (tank2_wall_count > 0) {
+         hit = tank2_walls[0];
          wallPrev = NULL;
          wallIter = walls;
          //find wall collided with
@@ -513,100 +571,11 @@ void drawTask(void *vParam) {
       }
       
       //adjust tank2
-      vSpriteSetRotation(tank2.handle, (uint16_t)tank2.angle);
-      vSpriteSetPosition(tank2.handle, (uint16_t)tank2.pos.x, (uint16_t)tank2.pos.y);
+      vSpriteSetTransform(tank2.handle, (uint16_t)tank2.pos.x, (uint16_t)tank2.pos.y,
+       (uint16_t)tank2.angle);
       
-      // Check hits from tank1
-		objPrev = NULL;
-		objIter = bullets_tank1;
-		while (objIter != NULL) {
-   		vSpriteSetPosition(objIter->handle, (uint16_t)objIter->pos.x, (uint16_t)objIter->pos.y);
-         //// Check hits from tank1 on tank2
-         if (uCollide(objIter->handle, tankGroup2, &hit, 1) > 0) {
-      		vSpriteDelete(objIter->handle);
-      		tank2.life -= DAMAGE; 
-            tank2_health_img++;
-            vSpriteDelete(health2);
-            health2 = xSpriteCreate(health_images2[tank2_health_img],HEALTH_BAR_OFFSET_P2, SCREEN_H>>3, 0, HEALTH_BAR_SIZE, HEALTH_BAR_SIZE, 20);
-      		if (objPrev != NULL) {
-         		objPrev->next = objIter->next;
-         		vPortFree(objIter);
-         		objIter = objPrev->next;
-      		}
-            else {
-         		bullets_tank1 = objIter->next;
-         		vPortFree(objIter);
-         		objIter = bullets_tank1;
-      		}
-            if(tank2.life <= 0)
-               game_status = PLAYER_ONE_WIN;
-		   }
-         else if (uCollide(objIter->handle, wallGroup, &hit, 1) > 0) {
-            vSpriteDelete(objIter->handle);
-            
-            if (objPrev != NULL) {
-               objPrev->next = objIter->next;
-               vPortFree(objIter);
-               objIter = objPrev->next;
-            }
-            else {
-               bullets_tank1 = objIter->next;
-               vPortFree(objIter);
-               objIter = bullets_tank1;
-            }
-         }
-         else {
-            objPrev = objIter;
-            objIter = objIter->next;
-         }
-      }
-
-      // Check hits from tank2
-      objPrev = NULL;
-      objIter = bullets_tank2;
-      while (objIter != NULL) {
-         vSpriteSetPosition(objIter->handle, (uint16_t)objIter->pos.x, (uint16_t)objIter->pos.y);
-         //// Check hits from tank2 on tank1
-         if (uCollide(objIter->handle, tankGroup1, &hit, 1) > 0) {
-            vSpriteDelete(objIter->handle);
-            tank1.life -= DAMAGE;
-            tank1_health_img++;
-            vSpriteDelete(health1);
-            health1 = xSpriteCreate(health_images1[tank1_health_img],HEALTH_BAR_OFFSET_P1, SCREEN_H>>3, 0, HEALTH_BAR_SIZE, HEALTH_BAR_SIZE, 20);
-            
-            if (objPrev != NULL) {
-               objPrev->next = objIter->next;
-               vPortFree(objIter);
-               objIter = objPrev->next;
-            }
-            else {
-               bullets_tank2 = objIter->next;
-               vPortFree(objIter);
-               objIter = bullets_tank2;
-            }
-            if(tank1.life <= 0)
-               game_status = PLAYER_TWO_WIN;
-         }
-         else if (uCollide(objIter->handle, wallGroup, &hit, 1) > 0) {
-            vSpriteDelete(objIter->handle);
-            
-            if (objPrev != NULL) {
-               objPrev->next = objIter->next;
-               vPortFree(objIter);
-               objIter = objPrev->next;
-            }
-            else {
-               bullets_tank2 = objIter->next;
-               vPortFree(objIter);
-               objIter = bullets_tank2;
-            }
-         }
-         else {
-            objPrev = objIter;
-            objIter = objIter->next;
-         }
-      }
-
+      // Bullets fly straight on their own, so they need no updates
+      vFrameEnd();
 
       if((game_status == PLAYER_ONE_WIN)||(game_status == PLAYER_TWO_WIN)){
          vTaskDelete(update1TaskHandle);
@@ -617,12 +586,12 @@ void drawTask(void *vParam) {
          vTaskDelete(input2TaskHandle);
          switch(game_status){
             case PLAYER_ONE_WIN:
-               handle = xSpriteCreate("p1_win_round.png", SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W>>1, SCREEN_H>>1, 100);
+               handle = xSpriteCreate(screen_images[P1_WIN_ROUND_IMG], SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W>>1, SCREEN_H>>1, 100);
                p1_score ++;
                game_round++;
                break;
             case PLAYER_TWO_WIN:
-               handle = xSpriteCreate("p2_win_round.png", SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W>>1, SCREEN_H>>1, 100);
+               handle = xSpriteCreate(screen_images[P2_WIN_ROUND_IMG], SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W>>1, SCREEN_H>>1, 100);
                p2_score ++;
                game_round++;
                break;
@@ -635,9 +604,9 @@ void drawTask(void *vParam) {
          if((game_round >= NUM_ROUNDS)||(p1_score == NUM_ROUNDS - 1)||(p2_score == NUM_ROUNDS - 1))
          {
             if(p1_score > p2_score)
-               handle = xSpriteCreate("p1_win.png", SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W>>1, SCREEN_H>>1, 100);
+               handle = xSpriteCreate(screen_images[P1_WIN_IMG], SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W>>1, SCREEN_H>>1, 100);
             else
-               handle = xSpriteCreate("p2_win.png", SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W>>1, SCREEN_H>>1, 100);
+               handle = xSpriteCreate(screen_images[P2_WIN_IMG], SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W>>1, SCREEN_H>>1, 100);
                
             _delay_ms(GAME_RESET_DELAY_MS);
             vSpriteDelete(handle);
@@ -697,7 +666,7 @@ int main(void) {
 	xTaskCreate(updateTask, (signed char *) "u", 200, &tank_info1, 3, &update1TaskHandle);
 	xTaskCreate(updateTask, (signed char *) "u", 200, &tank_info2, 3, &update2TaskHandle);
 	xTaskCreate(drawTask, (signed char *) "d", 800, NULL, 2, NULL);
-	xTaskCreate(USART_Write_Task, (signed char *) "w", 500, NULL, 5, &uartTaskHandle);
+	xGraphicsRxTaskCreate(2);
 	
 	vTaskStartScheduler();
 	
@@ -718,20 +687,31 @@ void init(void) {
    bullets_tank2 = NULL;
    tankGroup1 = ERROR_HANDLE;
    tankGroup2 = ERROR_HANDLE;
-	xSpriteHandle number; 
+   tank1_wall_count = 0;
+   tank2_wall_count = 0;
+	xSpriteHandle number;
+	char round_text[] = "ROUND 1";
+	char count_text[] = "3"; 
+	xCollisionEvent event;
+   
+   // Drop any events still queued from the previous round's sprites
+   while (xCollisionEventReceive(&event, 0) == pdTRUE)
+      ;
    
    tank1.life = MAX_LIFE;
    tank2.life = MAX_LIFE;
    // function to initialize program
    if(game_round == 0)
       startup();
-	background = xSpriteCreate("map.png", SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W, SCREEN_H, 0);
+	background = xSpriteCreate(screen_images[MAP_IMG], SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W, SCREEN_H, 0);
 	
 	srand(TCNT0);
 	
 	wallGroup = xGroupCreate();
 	tankGroup1 = xGroupCreate();
    tankGroup2 = xGroupCreate();
+   bulletGroup1 = xGroupCreate();
+   bulletGroup2 = xGroupCreate();
 
    // tank1 create
 	tank1.handle = xSpriteCreate(
@@ -780,17 +760,32 @@ void init(void) {
    vGroupAddSprite(tankGroup1, tank1.handle);
    vGroupAddSprite(tankGroup2, tank2.handle);
    
-   // Series of flashing sprites to display the round, and a countdown to gameplay
-   number = xSpriteCreate(round_images[game_round], SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W>>1, SCREEN_H>>1, 20);
+   // Bullet sprites are made once per round and recycled after each hit
+   bulletPool1 = xSpritePoolCreate(bullet_images[p1_tank_num], BULLET_POOL_SIZE,
+    BULLET_SIZE, BULLET_SIZE, 1, bulletGroup1);
+   bulletPool2 = xSpritePoolCreate(bullet_images[p2_tank_num], BULLET_POOL_SIZE,
+    BULLET_SIZE, BULLET_SIZE, 1, bulletGroup2);
+   
+   // Have the graphics module report contacts instead of polling for them
+   vCollisionSubscribe(bulletGroup1, tankGroup2);
+   vCollisionSubscribe(bulletGroup2, tankGroup1);
+   vCollisionSubscribe(bulletGroup1, wallGroup);
+   vCollisionSubscribe(bulletGroup2, wallGroup);
+   vCollisionSubscribe(tankGroup1, wallGroup);
+   vCollisionSubscribe(tankGroup2, wallGroup);
+   
+   // One text sprite displays the round, and a countdown to gameplay
+   number = xTextCreate(FONT_DEFAULT, COUNTDOWN_FONT_SIZE, SCREEN_W>>1, SCREEN_H>>1, 20);
+   round_text[6] += game_round;
+   vTextSet(number, round_text);
    _delay_ms(1000);
-   vSpriteDelete(number);
    for(uint8_t i = 0; i < 3; i++)
    {
-      number = xSpriteCreate(num_images[i], SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W>>1, SCREEN_H>>1, 20);
+      vTextSet(number, count_text);
+      count_text[0]--;
       _delay_ms(750);
-      vSpriteDelete(number);
    }   
-   number = xSpriteCreate("go.png", SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W>>1, SCREEN_H>>1, 20);
+   vTextSet(number, "GO!");
    _delay_ms(1000);
    vSpriteDelete(number);   
 }
@@ -828,7 +823,6 @@ void reset(void) {
    
    // removes bullets_tank1
 	while (bullets_tank1 != NULL) {
-   	vSpriteDelete(bullets_tank1->handle);
    	nextObject = bullets_tank1->next;
    	vPortFree(bullets_tank1);
    	bullets_tank1 = nextObject;
@@ -836,18 +830,23 @@ void reset(void) {
    
 	// removes bullets_tank2
 	while (bullets_tank2 != NULL) {
-   	vSpriteDelete(bullets_tank2->handle);
    	nextObject = bullets_tank2->next;
    	vPortFree(bullets_tank2);
    	bullets_tank2 = nextObject;
 	}
    
+   // removes the bullet sprites, in flight or not
+   vSpritePoolDelete(bulletPool1);
+   vSpritePoolDelete(bulletPool2);
+   
    //removes the tanks
    vSpriteDelete(tank1.handle);
    vSpriteDelete(tank2.handle);
 
    vGroupDelete(tankGroup1);
    vGroupDelete(tankGroup2);
+   vGroupDelete(bulletGroup1);
+   vGroupDelete(bulletGroup2);
    //removes the background
    vSpriteDelete(background);
    
@@ -855,12 +854,154 @@ void reset(void) {
 }
 
 
+/*------------------------------------------------------------------------------
+ * Function: registerImageArray
+ *
+ * Description: This function registers every image name in an array with the
+ *  graphics module and stores the resulting image IDs. The IDs are consecutive,
+ *  so a sprite made from the first image can show any of the others with
+ *  vSpriteSetFrame.
+ *
+ * param files: The array of image file names.
+ * param images: The array to store the registered image IDs in.
+ * param count: The number of elements in both arrays.
+ *----------------------------------------------------------------------------*/
+void registerImageArray(const char *files[], xImageHandle images[], uint8_t count) {
+   xImageHandle first = xImageRegisterFrames(files, count);
+   
+   for(uint8_t i = 0; i < count; i++)
+      images[i] = first == ERROR_HANDLE ? ERROR_HANDLE : first + i;
+}
+
+/*------------------------------------------------------------------------------
+ * Function: registerImages
+ *
+ * Description: This function registers all of the game's images once at
+ *  startup so that sprites are created from small image IDs instead of
+ *  resending their file names.
+ *----------------------------------------------------------------------------*/
+void registerImages(void) {
+   registerImageArray(tank_image_files, tank_images, NUM_ARRAY_ELEMS(tank_images));
+   registerImageArray(bullet_image_files, bullet_images, NUM_ARRAY_ELEMS(bullet_images));
+   registerImageArray(health_image_files1, health_images1, NUM_ARRAY_ELEMS(health_images1));
+   registerImageArray(health_image_files2, health_images2, NUM_ARRAY_ELEMS(health_images2));
+   registerImageArray(screen_image_files, screen_images, NUM_ARRAY_ELEMS(screen_images));
+   registerImageArray(wall_image_files, wall_images, NUM_ARRAY_ELEMS(wall_images));
+}
+
+/*------------------------------------------------------------------------------
+ * Function: handleCollision
+ *
+ * Description: This function applies one contact change pushed by the graphics
+ *  module. Tank-wall contacts are tracked so drawTask can bounce the tank while
+ *  it touches any wall. A bullet that begins touching the enemy tank damages it,
+ *  and a bullet that begins touching a wall is removed. Events for bullets that
+ *  were already removed are ignored.
+ *
+ * param event: The collision event to apply.
+ * param game_status: The round status, set when a tank is destroyed.
+ *----------------------------------------------------------------------------*/
+void handleCollision(xCollisionEvent *event, uint8_t *game_status) {
+   if (event->sprite == tank1.handle) {
+      updateWallContacts(tank1_walls, &tank1_wall_count, event);
+   }
+   else if (event->sprite == tank2.handle) {
+      updateWallContacts(tank2_walls, &tank2_wall_count, event);
+   }
+   else if (event->type != STATUS_COLLISION_BEGIN) {
+      return;
+   }
+   else if (event->other == tank2.handle) {
+      //// Check hits from tank1 on tank2
+      if (removeBullet(&bullets_tank1, bulletPool1, event->sprite)) {
+         tank2.life -= DAMAGE;
+         tank2_health_img++;
+         vSpriteSetFrame(health2, tank2_health_img);
+         if(tank2.life <= 0)
+            *game_status = PLAYER_ONE_WIN;
+      }
+   }
+   else if (event->other == tank1.handle) {
+      //// Check hits from tank2 on tank1
+      if (removeBullet(&bullets_tank2, bulletPool2, event->sprite)) {
+         tank1.life -= DAMAGE;
+         tank1_health_img++;
+         vSpriteSetFrame(health1, tank1_health_img);
+         if(tank1.life <= 0)
+            *game_status = PLAYER_TWO_WIN;
+      }
+   }
+   else if (!removeBullet(&bullets_tank1, bulletPool1, event->sprite)) {
+      removeBullet(&bullets_tank2, bulletPool2, event->sprite);
+   }
+}
+
+/*------------------------------------------------------------------------------
+ * Function: updateWallContacts
+ *
+ * Description: This function adds or removes one wall from the walls a tank is
+ *  touching, so the tank keeps bouncing at a corner until it has left every
+ *  wall there. Contacts beyond MAX_WALL_CONTACTS are dropped.
+ *
+ * param contacts: The walls the tank is touching.
+ * param count: The number of walls in contacts.
+ * param event: A collision event for the tank.
+ *----------------------------------------------------------------------------*/
+void updateWallContacts(xSpriteHandle contacts[], uint8_t *count, xCollisionEvent *event) {
+   uint8_t i;
+   
+   for (i = 0; i < *count; i++) {
+      if (contacts[i] == event->other)
+         break;
+   }
+   
+   if (event->type == STATUS_COLLISION_BEGIN) {
+      if (i == *count && *count < MAX_WALL_CONTACTS)
+         contacts[(*count)++] = event->other;
+   }
+   else if (i < *count) {
+      for (; i + 1 < *count; i++)
+         contacts[i] = contacts[i + 1];
+      (*count)--;
+   }
+}
+
+/*------------------------------------------------------------------------------
+ * Function: removeBullet
+ *
+ * Description: This function finds a bullet by its sprite handle, returns its
+ *  sprite to the bullet pool, and unlinks and frees it.
+ *
+ * param bullets: A pointer to the head of the bullet list to search.
+ * param pool: The sprite pool the list's bullets were taken from.
+ * param handle: The sprite handle of the bullet to remove.
+ * return: 1 if the bullet was found and removed, 0 otherwise.
+ *----------------------------------------------------------------------------*/
+uint8_t removeBullet(object **bullets, xSpritePoolHandle pool, xSpriteHandle handle) {
+   object *objIter = *bullets, *objPrev = NULL;
+   
+   while (objIter != NULL) {
+      if (objIter->handle == handle) {
+         vSpritePoolRelease(pool, objIter->handle);
+         if (objPrev != NULL)
+            objPrev->next = objIter->next;
+         else
+            *bullets = objIter->next;
+         vPortFree(objIter);
+         return 1;
+      }
+      objPrev = objIter;
+      objIter = objIter->next;
+   }
+   return 0;
+}
+
 /*------------------------------------------------------------------------------
  * Function: createWall
  *
  * Description: This function creates a new wall
  *
- * param *image: The string for the file to be used as the walls sprite.
+ * param image: The registered image ID to be used as the walls sprite.
  * param x: The center x position of the new wall sprite.
  * param y: The center y position of the new wall sprite.
  * param nxt: A pointer to the next wall in a linked list of walls.
@@ -868,13 +1009,13 @@ void reset(void) {
  * param width: The new walls width in tiles (50x50 pixels).
  * Return: wall*: 
  *----------------------------------------------------------------------------*/
-wall *createWall(char *image, float x, float y, wall *nxt, float height, float width) {
+wall *createWall(xImageHandle image, float x, float y, wall *nxt, float height, float width) {
    //allocate space for a new wall
    wall *newWall = pvPortMalloc(sizeof(wall));
    
    //setup wall sprite
    newWall->handle = xSpriteCreate(
-      image,                  //reference to png filename
+      image,                  //registered image ID
       x,                      //xPos
       y,                      //yPos
       0,                      //rAngle
@@ -901,7 +1042,8 @@ wall *createWall(char *image, float x, float y, wall *nxt, float height, float w
 /*------------------------------------------------------------------------------
  * Function: createBullet
  *
- * Description: This function creates a new bullet object.
+ * Description: This function creates a new bullet object, using a sprite from
+ *  the firing tank's bullet pool.
  *
  * param x: The starting x position of the new bullet sprite.
  * param y: The starting y position of the new bullet sprite.
@@ -909,34 +1051,23 @@ wall *createWall(char *image, float x, float y, wall *nxt, float height, float w
  * param vely: The new bullet's y velocity.
  * param nxt: A pointer to the next bullet object in a linked list of bullets.
  * return: A pointer to a malloc'd bullet object. This pointer must be freed by
- *  the caller.
+ *  the caller. If all of the tank's bullets are in flight, no bullet is made
+ *  and nxt is returned.
  *----------------------------------------------------------------------------*/
 object *createBullet(float x, float y, float velx, float vely, uint8_t tank_num, int16_t angle, object *nxt) {
-	//Create a new bullet object using a reentrant malloc() function
-	object *newBullet = pvPortMalloc(sizeof(object));
+	object *newBullet;
+	xSpriteHandle handle;
 	
-	//Setup the pointers in the linked list
-	//Create a new sprite using xSpriteCreate()
-   if(tank_num == 2) {
-   	newBullet->handle = xSpriteCreate(
-	   bullet_images[p2_tank_num],			//reference to png filename
-	      x,                   //xPos
-	      y,                   //yPos
-	      angle,                //rAngle
-	      BULLET_SIZE,			//width
-	      BULLET_SIZE,			//height
-	      1);                  //depth
-   }
-   else {
-      newBullet->handle = xSpriteCreate(
-         bullet_images[p1_tank_num],			//reference to png filename
-         x,                   //xPos
-         y,                   //yPos
-         angle,                //rAngle
-         BULLET_SIZE,			//width
-         BULLET_SIZE,			//height
-         1);                  //depth
-   }
+	//Take a hidden bullet sprite from the tank's pool and show it
+	handle = xSpritePoolAcquire(tank_num == 2 ? bulletPool2 : bulletPool1, x, y, angle);
+	if (handle == ERROR_HANDLE)
+	   return nxt;  //every bullet is already in flight
+	
+	//Create a new bullet object using a reentrant malloc() function
+	newBullet = pvPortMalloc(sizeof(object));
+	newBullet->handle = handle;
+   //the graphics module moves the bullet from here on
+   vSpriteSetVelocity(newBullet->handle, velx * FRAMES_PER_SEC, vely * FRAMES_PER_SEC);
    //set position
    newBullet->pos.x = x;
    newBullet->pos.y = y;
@@ -975,7 +1106,11 @@ void startup(void) {
    xSpriteHandle press_start;
    
    // Print opening start screen
-   xSpriteHandle start_screen = xSpriteCreate("start_screen.png", SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W, SCREEN_H, 0);
+   xSpriteHandle start_screen = xSpriteCreate(screen_images[START_SCREEN_IMG], SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W, SCREEN_H, 0);
+   
+   // "Press start" blinks by hiding and showing one sprite
+   press_start = xSpriteCreate(screen_images[PRESS_START_IMG], SCREEN_W>>1, SCREEN_H - (SCREEN_H>>2), 0, SCREEN_W>>1, SCREEN_H>>1, 1);
+   vSpriteSetVisible(press_start, 0);
    
    // Initailize SNES Controllers
    snesInit(SNES_2P_MODE);
@@ -988,21 +1123,20 @@ void startup(void) {
       
       // blink "Press start"
       if(press_start_loop_count++ == 30)
-         press_start = xSpriteCreate("press_start.png", SCREEN_W>>1, SCREEN_H - (SCREEN_H>>2), 0, SCREEN_W>>1, SCREEN_H>>1, 1);
+         vSpriteSetVisible(press_start, 1);
       else if(press_start_loop_count == 60) {
-         vSpriteDelete(press_start);
+         vSpriteSetVisible(press_start, 0);
          press_start_loop_count = 0; 
       } 
    }
    _delay_ms(250);
-   if(press_start_loop_count >= 30)
-      vSpriteDelete(press_start);
+   vSpriteDelete(press_start);
       
    _delay_ms(500);
    vSpriteDelete(start_screen);
    
    // Display the tank select screen
-   xSpriteHandle select_screen = xSpriteCreate("select_screen.png", SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W, SCREEN_H, 0);
+   xSpriteHandle select_screen = xSpriteCreate(screen_images[SELECT_SCREEN_IMG], SCREEN_W>>1, SCREEN_H>>1, 0, SCREEN_W, SCREEN_H, 0);
     
    controller_data1 = 0;
    controller_data2 = 0;
@@ -1010,8 +1144,8 @@ void startup(void) {
    p1_tank_num = p2_tank_num = 0;
    
    // Display initial hover selection sprites on tank0
-   p1 = xSpriteCreate("p1.png", ((2*p1_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1, 0, TANK_SEL_BANNER_SIZE, TANK_SEL_BANNER_SIZE, 1);
-   p2 = xSpriteCreate("p2.png", ((2*p2_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1, 0, TANK_SEL_BANNER_SIZE, TANK_SEL_BANNER_SIZE, 1);
+   p1 = xSpriteCreate(screen_images[P1_IMG], ((2*p1_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1, 0, TANK_SEL_BANNER_SIZE, TANK_SEL_BANNER_SIZE, 1);
+   p2 = xSpriteCreate(screen_images[P2_IMG], ((2*p2_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1, 0, TANK_SEL_BANNER_SIZE, TANK_SEL_BANNER_SIZE, 1);
    
    // get a valid tank selection from both controllers
    while((p1_sel == TANK_NOT_SELECTED) || (p2_sel == TANK_NOT_SELECTED)) {   
@@ -1036,27 +1170,9 @@ void startup(void) {
             default:
                break;
          }
-         // Display update hover selection sprites over the chosen tank
-         if((controller_data1 & SNES_RIGHT_BTN)||(controller_data1 & SNES_LEFT_BTN)) {
-            vSpriteDelete(p1);
-            switch(p1_tank_num) {
-               case 0:
-                  p1 = xSpriteCreate("p1.png", ((2*p1_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1, 0, TANK_SEL_BANNER_SIZE, TANK_SEL_BANNER_SIZE, 1);
-                  break;
-               case 1:
-                  p1 = xSpriteCreate("p1.png", ((2*p1_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1, 0, TANK_SEL_BANNER_SIZE, TANK_SEL_BANNER_SIZE, 1);
-                  break;
-               case 2:
-                  p1 = xSpriteCreate("p1.png", ((2*p1_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1, 0, TANK_SEL_BANNER_SIZE, TANK_SEL_BANNER_SIZE, 1);
-                  break;
-               case 3:
-                  p1 = xSpriteCreate("p1.png", ((2*p1_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1, 0, TANK_SEL_BANNER_SIZE, TANK_SEL_BANNER_SIZE, 1);
-                  break;
-               default:
-                  p1 = xSpriteCreate("p1.png", ((2*p1_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1, 0, TANK_SEL_BANNER_SIZE, TANK_SEL_BANNER_SIZE, 1);
-                  break;
-            }
-         }
+         // Move the hover selection sprite over the chosen tank
+         if((controller_data1 & SNES_RIGHT_BTN)||(controller_data1 & SNES_LEFT_BTN))
+            vSpriteSetPosition(p1, ((2*p1_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1);
       }
       // check if valid button is pressed
       if(p2_sel == TANK_NOT_SELECTED) {
@@ -1079,27 +1195,9 @@ void startup(void) {
             default:
                break;
          }
-         // Display update hover selection sprites over the chosen tank
-        if((controller_data2 & SNES_RIGHT_BTN)||(controller_data2 & SNES_LEFT_BTN)) {
-            vSpriteDelete(p2);
-            switch(p2_tank_num) {
-               case 0:
-                  p2 = xSpriteCreate("p2.png", ((2*p2_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1, 0, TANK_SEL_BANNER_SIZE, TANK_SEL_BANNER_SIZE, 1);
-                  break;
-               case 1:
-                  p2 = xSpriteCreate("p2.png", ((2*p2_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1, 0, TANK_SEL_BANNER_SIZE, TANK_SEL_BANNER_SIZE, 1);
-                  break;
-               case 2:
-                  p2 = xSpriteCreate("p2.png", ((2*p2_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1, 0, TANK_SEL_BANNER_SIZE, TANK_SEL_BANNER_SIZE, 1);
-                  break;
-               case 3:
-                  p2 = xSpriteCreate("p2.png", ((2*p2_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1, 0, TANK_SEL_BANNER_SIZE, TANK_SEL_BANNER_SIZE, 1);
-                  break;
-               default:
-                  p2 = xSpriteCreate("p2.png", ((2*p2_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1, 0, TANK_SEL_BANNER_SIZE, TANK_SEL_BANNER_SIZE, 1);
-                  break;
-            }
-         }         
+         // Move the hover selection sprite over the chosen tank
+         if((controller_data2 & SNES_RIGHT_BTN)||(controller_data2 & SNES_LEFT_BTN))
+            vSpriteSetPosition(p2, ((2*p2_tank_num + 1)*SCREEN_W)/8, SCREEN_H>>1);
       }    
       _delay_ms(150);
    }
@@ -1120,7 +1218,7 @@ void startup(void) {
  void createEnvironment(void) {
     
     borders = createWall(
-       "width_wall.bmp",
+       wall_images[WIDTH_WALL_IMG],
        SCREEN_W >> 1,
        0,
        borders,
@@ -1128,7 +1226,7 @@ void startup(void) {
        WALL_WIDTH);
     
     borders = createWall(
-       "width_wall.bmp",
+       wall_images[WIDTH_WALL_IMG],
        SCREEN_W >> 1,
        SCREEN_H,
        borders,
@@ -1136,7 +1234,7 @@ void startup(void) {
        WALL_WIDTH);
     
     borders = createWall(
-       "side_wall.bmp",
+       wall_images[SIDE_WALL_IMG],
        0,
        SCREEN_H >> 1,
        borders,
@@ -1144,7 +1242,7 @@ void startup(void) {
        WALL_SINGLE_TILE);
     
     borders = createWall(
-       "side_wall.bmp",
+       wall_images[SIDE_WALL_IMG],
        SCREEN_W,
        SCREEN_H >> 1,
        borders,
@@ -1152,7 +1250,7 @@ void startup(void) {
        WALL_SINGLE_TILE);
     
     walls = createWall(
-       "wall.bmp",
+       wall_images[MID_WALL_IMG],
        SCREEN_W >> 1,
        SCREEN_H >> 1,
        walls,
@@ -1160,7 +1258,7 @@ void startup(void) {
        WALL_SINGLE_TILE);
     
     walls = createWall(
-       "small_wall.bmp",
+       wall_images[SMALL_WALL_IMG],
        SCREEN_W - WALL_SMALL_POS * WALL_SIZE,
        SCREEN_H >> 2,
        walls,
@@ -1168,7 +1266,7 @@ void startup(void) {
        WALL_SMALL_SIZE);
     
     walls = createWall(
-       "small_wall.bmp",
+       wall_images[SMALL_WALL_IMG],
        WALL_SMALL_POS * WALL_SIZE,
        SCREEN_H - (SCREEN_H >> 2),
        walls,
@@ -1176,7 +1274,7 @@ void startup(void) {
        WALL_SMALL_SIZE);
     
     walls = createWall(
-       "block_wall.bmp",
+       wall_images[BLOCK_WALL_IMG],
        SCREEN_W - WALL_BLOCK_W_POS * WALL_SIZE,
        SCREEN_H - WALL_BLOCK_H_POS * WALL_SIZE,
        walls,
@@ -1184,7 +1282,7 @@ void startup(void) {
        WALL_BLOCK);
     
     walls = createWall(
-       "block_wall.bmp",
+       wall_images[BLOCK_WALL_IMG],
        WALL_BLOCK_W_POS * WALL_SIZE,
        WALL_BLOCK_H_POS * WALL_SIZE,
        walls,
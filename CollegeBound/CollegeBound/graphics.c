@@ -1,5 +1,9 @@
 #include "graphics.h"
+#include "task.h"
+#include "queue.h"
 #include "usart.h"
+#include <lib_crc.h>
+#include <string.h>
 
 /* Sprite functions */
 #define CREATE_SPRITE       0x01
@@ -8,6 +12,34 @@
 #define SET_ORDER           0x0C
 #define SET_SIZE            0x0D
 #define DELETE_SPRITE       0x04
+#define SET_VELOCITY        0x26
+#define SET_ANGULAR_VELOCITY 0x27
+#define SET_VISIBLE         0x28
+#define SET_FRAME           0x2A
+#define SET_SCREEN_SPACE    0x2F
+#define ATTACH              0x30
+
+/* Camera functions */
+#define SET_CAMERA          0x2E
+
+/* Text functions */
+#define CREATE_TEXT         0x2B
+#define SET_TEXT            0x2C
+
+/* Tilemap functions */
+#define LOAD_TILEMAP        0x2D
+#define TILEMAP_BITS_PER_BYTE 7
+
+/* Sprite pools */
+#define SPRITE_POOL_COUNT   4
+#define SPRITE_POOL_MAX     16
+
+/* Combined transform; the low nibble holds the XFORM_* flags */
+#define SET_TRANSFORM       0x10
+#define XFORM_X             0x01
+#define XFORM_Y             0x02
+#define XFORM_ANGLE         0x04
+#define XFORM_FULL          0x08
 
 /* Collision functions */
 #define CREATE_GROUP        0x05
@@ -15,26 +47,563 @@
 #define REMOVE_FROM_GROUP   0x07
 #define DELETE_GROUP        0x08
 #define COLLIDE             0x09
+#define COLLIDE_BATCH       0x21
+#define SUBSCRIBE_COLLISIONS 0x22
+#define UNSUBSCRIBE_COLLISIONS 0x23
 
 #define CREATE_WINDOW       0x0A
 #define PYTHON_PRINT        0x0B
 
+/* Link speed negotiation */
+#define SET_BAUD            0x24
+#define PING                0x25
+#define BAUD_ACCEPTED       0x01
+#define BAUD_PROBE_TRIES    2
+/* Time for the graphics context to switch rates after accepting */
+#define BAUD_SWITCH_DELAY   (20 / portTICK_RATE_MS)
+/* Longer than the graphics context waits at a new rate before reverting */
+#define BAUD_FALLBACK_DELAY (2000 / portTICK_RATE_MS)
+/* Dropped packets within BAUD_DROP_FRAMES frames that force a slower rate */
+#define BAUD_DROP_LIMIT     4
+#define BAUD_DROP_FRAMES    64
+
+/* Image functions */
+#define REGISTER_IMAGE      0x20
+#define REGISTER_SHEET      0x29
+#define LAST_IMAGE_HANDLE   0xFD
+
+/* Sprite handles allocated by the AVR */
+#define FIRST_SPRITE_HANDLE 0x01
+#define LAST_SPRITE_HANDLE  0xFD
+
+/* Marks a STATUS_RECORD_SIZE byte status record from the graphics context */
+#define STATUS_MARKER       0xFE
+#define STATUS_RECORD_SIZE  4
+/* Sent when a packet failed its CRC; handled internally */
+#define STATUS_PACKET_DROPPED 0x03
+
+/* Every command is sent as PACKET_SYNC, length, payload, then a CRC-16/CCITT
+ * of the length and payload, so the graphics context can drop a corrupt
+ * command and find the start of the next one */
+#define PACKET_SYNC         0xA5
+#define PACKET_OVERHEAD     4
+#define PACKET_PAYLOAD_MAX  64
+
+/* How long to wait for a reply the graphics context may never send */
+#define REPLY_TIMEOUT       (500 / portTICK_RATE_MS)
+
+#define REPLY_QUEUE_SIZE    32
+/* Stack depth of the task from xGraphicsRxTaskCreate */
+#define GRAPHICS_RX_STACK   200
+#define COLLISION_QUEUE_SIZE 16
+
+/* Frame batching */
+#define BEGIN_FRAME         0x0E
+#define END_FRAME           0x0F
+
+/* Field mask bits of a frame record */
+#define FIELD_POS           0x01
+#define FIELD_ROT           0x02
+#define FIELD_SIZE          0x04
+#define FIELD_DEPTH         0x08
+#define FIELD_DELTA         0x10
+#define FIELD_VELOCITY      0x20
+#define FIELD_ANGULAR_VEL   0x40
+#define FIELD_VISIBLE       0x80
+
+#define FRAME_MAX_RECORDS   16
+/* Longest encoded frame record: handle, mask, 3 varints, size, depth, velocity,
+ * angular velocity and visibility */
+#define FRAME_RECORD_MAX    23
+#define TRANSFORM_CACHE_SIZE 16
+
 #define BAUD_RATE			38400
+/* Bytes sent beyond the count the graphics context last acknowledged */
+#define HOST_RX_WINDOW      512
+
+/* Rates tried by ulGraphicsNegotiateBaud, fastest first. All are exact with
+ * U2X at 16 MHz (UBRR 1, 3 and 7). */
+static const uint32_t baudRates[] = {1000000, 500000, 250000};
+#define BAUD_RATE_COUNT     (sizeof(baudRates) / sizeof(baudRates[0]))
+
+/* Pending changes to a single sprite within the current frame */
+typedef struct {
+	xSpriteHandle sprite;
+	uint8_t mask;
+	uint16_t x, y;
+	uint16_t angle;
+	uint16_t width, height;
+	uint8_t depth;
+	int16_t vx, vy;
+	int16_t angularVel;
+	uint8_t visible;
+} frameRecord;
+
+/* Sprites created up front and shown or hidden instead of created and deleted.
+ * The free sprites are sprites[0] to sprites[freeCount - 1]; count is 0 when
+ * the pool is not in use. */
+typedef struct {
+	xSpriteHandle sprites[SPRITE_POOL_MAX];
+	uint8_t count;
+	uint8_t freeCount;
+} spritePool;
+
+/* Last position and angle the graphics context was sent for a sprite */
+typedef struct {
+	xSpriteHandle sprite;
+	uint16_t x, y;
+	uint16_t angle;
+} transformBase;
+
+static spritePool spritePools[SPRITE_POOL_COUNT];
+
+static frameRecord frameRecords[FRAME_MAX_RECORDS];
+static uint8_t frameRecordCount = 0;
+static uint8_t frameOpen = 0;
+
+/* Camera move made while a frame is open, sent with the frame */
+static uint8_t cameraPending = 0;
+static uint16_t cameraX, cameraY, cameraZoom;
+
+/* Direct-mapped on the sprite handle; sprite is ERROR_HANDLE when empty */
+static transformBase transformCache[TRANSFORM_CACHE_SIZE];
+/* Set when the graphics context dropped a packet, which may have held deltas */
+static volatile uint8_t transformResync = 0;
+
+/* Index into baudRates of the rate in use, or BAUD_RATE_COUNT for BAUD_RATE */
+static uint8_t baudLevel = BAUD_RATE_COUNT;
+static volatile uint8_t packetDrops = 0;
+static uint8_t dropFrames = 0;
+
+/* One bit per sprite handle; a set bit means the handle is in use */
+static uint8_t spriteHandles[(LAST_SPRITE_HANDLE >> 3) + 1];
+/* Handles deleted while a frame is open, freed by vFrameEnd. Records for them
+ * may already have been flushed, so they must not be reused in the same frame */
+static uint8_t spriteHandlesDeleted[(LAST_SPRITE_HANDLE >> 3) + 1];
+static xSpriteHandle nextSpriteHandle = FIRST_SPRITE_HANDLE;
+
+static xImageHandle nextImageHandle = 0;
+
+/* Oldest unread asynchronous error from the graphics context */
+static uint8_t pendingStatus = STATUS_OK;
+static uint8_t pendingStatusHandle = ERROR_HANDLE;
+
+/* Filled by the task from xGraphicsRxTaskCreate, if it is running */
+static xQueueHandle replyQueue;
+static xQueueHandle collisionQueue;
+static volatile uint8_t rxTaskRunning = 0;
+
+/* Set when a query gives up on its reply, which may still arrive late */
+static uint8_t replyStale = 0;
+
+/*******************************************************************************
+* Function: prvSpriteHandleAlloc
+*
+* Description: Allocates an unused sprite handle so sprites can be created
+*  without waiting for the graphics context to return one. Handles are handed
+*  out round-robin so a freed handle is not immediately reused.
+*
+* return: The allocated handle, or ERROR_HANDLE if all handles are in use
+*******************************************************************************/
+static xSpriteHandle prvSpriteHandleAlloc(void) {
+	xSpriteHandle handle = nextSpriteHandle;
+	
+	do {
+		if (!(spriteHandles[handle >> 3] & (1 << (handle & 0x07)))) {
+			spriteHandles[handle >> 3] |= 1 << (handle & 0x07);
+			nextSpriteHandle = handle == LAST_SPRITE_HANDLE ?
+			 FIRST_SPRITE_HANDLE : handle + 1;
+			return handle;
+		}
+		handle = handle == LAST_SPRITE_HANDLE ? FIRST_SPRITE_HANDLE : handle + 1;
+	} while (handle != nextSpriteHandle);
+	
+	return ERROR_HANDLE;
+}
+
+/*******************************************************************************
+* Function: prvSpriteHandleFree
+*
+* Description: Returns a sprite handle to the pool of unused handles.
+*
+* param sprite: The handle to free
+*******************************************************************************/
+static void prvSpriteHandleFree(xSpriteHandle sprite) {
+	if (sprite >= FIRST_SPRITE_HANDLE && sprite <= LAST_SPRITE_HANDLE)
+		spriteHandles[sprite >> 3] &= ~(1 << (sprite & 0x07));
+}
+
+/*******************************************************************************
+* Function: prvStatusRecord
+*
+* Description: Reads the rest of a status record after its STATUS_MARKER.
+*  Collision events are queued for xCollisionEventReceive; errors are kept
+*  until they are read with uGraphicsStatus.
+*******************************************************************************/
+static void prvStatusRecord(void) {
+	xCollisionEvent event;
+	uint8_t status = USART_Read();
+	uint8_t handle = USART_Read();
+	uint8_t other = USART_Read();
+	
+	if (status == STATUS_COLLISION_BEGIN || status == STATUS_COLLISION_END) {
+		event.type = status;
+		event.sprite = handle;
+		event.other = other;
+		xQueueSendToBack(collisionQueue, &event, 0);
+		return;
+	}
+	if (status == STATUS_PACKET_DROPPED) {
+		transformResync = 1;
+		if (packetDrops != 0xFF)
+			packetDrops++;
+		return;
+	}
+	
+	portENTER_CRITICAL();
+	if (pendingStatus == STATUS_OK) {
+		pendingStatus = status;
+		pendingStatusHandle = handle;
+	}
+	portEXIT_CRITICAL();
+}
+
+/*******************************************************************************
+* Function: prvReadReply
+*
+* Description: Reads the next byte of a reply from the graphics context,
+*  consuming any status records that arrive ahead of it. Gives up after
+*  REPLY_TIMEOUT, since the graphics context drops corrupt commands without
+*  replying to them, and marks the rest of the reply as stale so the next
+*  query discards it (see prvQueryBegin).
+*
+* return: The next reply byte, or ERROR_HANDLE on timeout
+*******************************************************************************/
+static uint8_t prvReadReply(void) {
+	uint8_t data;
+	
+	if (rxTaskRunning) {
+		if (xQueueReceive(replyQueue, &data, REPLY_TIMEOUT) != pdTRUE) {
+			replyStale = 1;
+			return ERROR_HANDLE;
+		}
+		return data;
+	}
+	
+	for (;;) {
+		if (USART_ReadTimeout(&data, REPLY_TIMEOUT) != pdTRUE) {
+			replyStale = 1;
+			return ERROR_HANDLE;
+		}
+		if (data != STATUS_MARKER)
+			return data;
+		prvStatusRecord();
+	}
+}
+
+/*******************************************************************************
+* Function: prvQueryBegin
+*
+* Description: Call before sending a command that is answered with a reply.
+*  If an earlier query timed out, its reply may have arrived since; those bytes
+*  are discarded so they are not read as the answer to this query. Status
+*  records among them are still handled.
+*******************************************************************************/
+static void prvQueryBegin(void) {
+	uint8_t data;
+	
+	if (!replyStale)
+		return;
+	replyStale = 0;
+	
+	if (rxTaskRunning) {
+		while (xQueueReceive(replyQueue, &data, 0) == pdTRUE)
+			;
+		return;
+	}
+	
+	while (USART_ReadTimeout(&data, 0) == pdTRUE) {
+		if (data == STATUS_MARKER)
+			prvStatusRecord();
+	}
+}
+
+/*******************************************************************************
+* Function: prvSendPacket
+*
+* Description: Sends one command to the graphics context wrapped in a packet:
+*  PACKET_SYNC, the payload length, the payload, and a CRC-16/CCITT of the
+*  length and payload, high byte first.
+*
+* param payload: The command to send
+* param length: The length of the command, at most PACKET_PAYLOAD_MAX
+*******************************************************************************/
+static void prvSendPacket(const uint8_t *payload, uint8_t length) {
+	uint8_t packet[PACKET_PAYLOAD_MAX + PACKET_OVERHEAD];
+	uint16_t crc;
+	
+	packet[0] = PACKET_SYNC;
+	packet[1] = length;
+	memcpy(&packet[2], payload, length);
+	crc = crc16_ccitt(&packet[1], length + 1);
+	packet[length + 2] = crc >> 8;
+	packet[length + 3] = crc & 0x00FF;
+	
+	USART_WriteBuf(packet, length + PACKET_OVERHEAD);
+}
+
+/*******************************************************************************
+* Function: prvTransformBase
+*
+* Description: Looks up the last transform sent for the given sprite.
+*
+* param sprite: The handle to the sprite
+* return: The sprite's cache entry, or NULL if the sprite is not cached
+*******************************************************************************/
+static transformBase *prvTransformBase(xSpriteHandle sprite) {
+	transformBase *base = &transformCache[sprite % TRANSFORM_CACHE_SIZE];
+	uint8_t i;
+	
+	/* Deltas may have been lost, so send full transforms until resynced */
+	if (transformResync) {
+		transformResync = 0;
+		for (i = 0; i < TRANSFORM_CACHE_SIZE; i++)
+			transformCache[i].sprite = ERROR_HANDLE;
+	}
+	
+	return base->sprite == sprite ? base : NULL;
+}
+
+/*******************************************************************************
+* Function: prvTransformStore
+*
+* Description: Caches a complete transform for the given sprite, evicting any
+*  other sprite sharing the same cache slot.
+*
+* param sprite: The handle to the sprite
+* param x: The sprite's x-position as last sent
+* param y: The sprite's y-position as last sent
+* param angle: The sprite's angle as last sent
+*******************************************************************************/
+static void prvTransformStore(xSpriteHandle sprite, uint16_t x, uint16_t y,
+ uint16_t angle) {
+	transformBase *base = &transformCache[sprite % TRANSFORM_CACHE_SIZE];
+	
+	base->sprite = sprite;
+	base->x = x;
+	base->y = y;
+	base->angle = angle;
+}
+
+/*******************************************************************************
+* Function: prvVarintLength
+*
+* Description: Computes how many bytes prvPutVarint uses for a delta.
+*
+* param delta: The signed delta to encode
+* return: The encoded length in bytes (1 to 3)
+*******************************************************************************/
+static uint8_t prvVarintLength(int16_t delta) {
+	uint16_t zigzag = ((uint16_t)delta << 1) ^ (uint16_t)(delta >> 15);
+	
+	if (zigzag < 0x80)
+		return 1;
+	if (zigzag < 0x4000)
+		return 2;
+	return 3;
+}
+
+/*******************************************************************************
+* Function: prvPutVarint
+*
+* Description: Writes a signed delta into a command buffer, zigzag encoded as a
+*  little-endian base-128 varint, so small deltas of either sign cost a single
+*  byte.
+*
+* param out: Where to write the encoded delta
+* param delta: The signed delta to write
+* return: The position just after the encoded delta
+*******************************************************************************/
+static uint8_t *prvPutVarint(uint8_t *out, int16_t delta) {
+	uint16_t zigzag = ((uint16_t)delta << 1) ^ (uint16_t)(delta >> 15);
+	
+	while (zigzag >= 0x80) {
+		*out++ = (zigzag & 0x7F) | 0x80;
+		zigzag >>= 7;
+	}
+	*out++ = zigzag;
+	return out;
+}
+
+/*******************************************************************************
+* Function: prvPut16
+*
+* Description: Writes a 16-bit value into a command buffer, high byte first.
+*
+* param out: Where to write the value
+* param value: The value to write
+* return: The position just after the value
+*******************************************************************************/
+static uint8_t *prvPut16(uint8_t *out, uint16_t value) {
+	*out++ = value >> 8;
+	*out++ = value & 0x00FF;
+	return out;
+}
+
+/*******************************************************************************
+* Function: prvFrameFlush
+*
+* Description: Sends all pending frame records to the external graphics context
+*  as BEGIN_FRAME commands, as many records per command as fit in a packet. The
+*  records are not applied by the graphics context until the matching END_FRAME
+*  is sent.
+*******************************************************************************/
+static void prvFrameFlush(void) {
+	frameRecord *record;
+	transformBase *base;
+	int16_t dx = 0, dy = 0, dAngle = 0;
+	uint8_t deltaLength, fullLength;
+	uint8_t cmd[PACKET_PAYLOAD_MAX];
+	uint8_t *out = &cmd[2];
+	uint8_t count = 0;
+	uint8_t i;
+	
+	for (i = 0; i < frameRecordCount; i++) {
+		record = &frameRecords[i];
+		
+		/* Send position and angle as deltas when that is shorter */
+		base = prvTransformBase(record->sprite);
+		if (base != NULL && (record->mask & (FIELD_POS | FIELD_ROT))) {
+			deltaLength = fullLength = 0;
+			if (record->mask & FIELD_POS) {
+				dx = record->x - base->x;
+				dy = record->y - base->y;
+				deltaLength += prvVarintLength(dx) + prvVarintLength(dy);
+				fullLength += 4;
+				base->x = record->x;
+				base->y = record->y;
+			}
+			if (record->mask & FIELD_ROT) {
+				dAngle = record->angle - base->angle;
+				deltaLength += prvVarintLength(dAngle);
+				fullLength += 2;
+				base->angle = record->angle;
+			}
+			if (deltaLength < fullLength)
+				record->mask |= FIELD_DELTA;
+		}
+		else if ((record->mask & (FIELD_POS | FIELD_ROT)) ==
+		 (FIELD_POS | FIELD_ROT)) {
+			/* A full transform is a base to send the next frame's deltas from */
+			prvTransformStore(record->sprite, record->x, record->y,
+			 record->angle);
+		}
+		
+		*out++ = record->sprite;
+		*out++ = record->mask;
+		if (record->mask & FIELD_DELTA) {
+			if (record->mask & FIELD_POS) {
+				out = prvPutVarint(out, dx);
+				out = prvPutVarint(out, dy);
+			}
+			if (record->mask & FIELD_ROT)
+				out = prvPutVarint(out, dAngle);
+		}
+		else if (record->mask & FIELD_POS) {
+			out = prvPut16(out, record->x);
+			out = prvPut16(out, record->y);
+		}
+		if ((record->mask & (FIELD_ROT | FIELD_DELTA)) == FIELD_ROT)
+			out = prvPut16(out, record->angle);
+		if (record->mask & FIELD_SIZE) {
+			out = prvPut16(out, record->width);
+			out = prvPut16(out, record->height);
+		}
+		if (record->mask & FIELD_DEPTH)
+			*out++ = record->depth;
+		if (record->mask & FIELD_VELOCITY) {
+			out = prvPut16(out, record->vx);
+			out = prvPut16(out, record->vy);
+		}
+		if (record->mask & FIELD_ANGULAR_VEL)
+			out = prvPut16(out, record->angularVel);
+		if (record->mask & FIELD_VISIBLE)
+			*out++ = record->visible;
+		count++;
+		
+		if (i + 1 == frameRecordCount ||
+		 out - cmd > PACKET_PAYLOAD_MAX - FRAME_RECORD_MAX) {
+			cmd[0] = BEGIN_FRAME;
+			cmd[1] = count;
+			prvSendPacket(cmd, out - cmd);
+			out = &cmd[2];
+			count = 0;
+		}
+	}
+	frameRecordCount = 0;
+}
+
+/*******************************************************************************
+* Function: prvFrameRecord
+*
+* Description: Finds the pending frame record for the given sprite, allocating
+*  a new one if the sprite has not been changed yet this frame. Records are
+*  flushed early if the record table fills up.
+*
+* param sprite: The handle to the sprite being changed
+* return: The record to merge the sprite's changed fields into
+*******************************************************************************/
+static frameRecord *prvFrameRecord(xSpriteHandle sprite) {
+	uint8_t i;
+	
+	for (i = 0; i < frameRecordCount; i++) {
+		if (frameRecords[i].sprite == sprite)
+			return &frameRecords[i];
+	}
+	
+	if (frameRecordCount == FRAME_MAX_RECORDS)
+		prvFrameFlush();
+	
+	frameRecords[frameRecordCount].sprite = sprite;
+	frameRecords[frameRecordCount].mask = 0;
+	return &frameRecords[frameRecordCount++];
+}
+
+/*******************************************************************************
+* Function: prvFrameDiscard
+*
+* Description: Drops any pending frame record for the given sprite so that no
+*  changes are applied to a handle after it has been deleted.
+*
+* param sprite: The handle to the sprite being deleted
+*******************************************************************************/
+static void prvFrameDiscard(xSpriteHandle sprite) {
+	uint8_t i;
+	
+	for (i = 0; i < frameRecordCount; i++) {
+		if (frameRecords[i].sprite == sprite) {
+			frameRecords[i] = frameRecords[--frameRecordCount];
+			return;
+		}
+	}
+}
 
 /*******************************************************************************
 * Function: vPrint
 *
 * Description: Prints the supplied string to the python terminal.  Useful for 
-*  debugging.
+*  debugging. Strings longer than a packet are truncated.
 *
 * param s: The string to print out.
 *******************************************************************************/
 void vPrint(const char *s) {
-	USART_Write(PYTHON_PRINT);
-	while (*s != '\0') {
-		USART_Write((uint8_t)*s++);
-	}
-	USART_Write(0x00);  /* string is null-terminated */
+	uint8_t cmd[PACKET_PAYLOAD_MAX];
+	uint8_t length = strnlen(s, PACKET_PAYLOAD_MAX - 2);
+	
+	cmd[0] = PYTHON_PRINT;
+	memcpy(&cmd[1], s, length);
+	cmd[length + 1] = 0x00;  /* string is null-terminated */
+	prvSendPacket(cmd, length + 2);
 }
 
 /*******************************************************************************
@@ -47,60 +616,284 @@ void vPrint(const char *s) {
 * param height: Desired height of the window in pixels
 *******************************************************************************/
 void vWindowCreate(uint16_t width, uint16_t height) {
+	uint8_t cmd[5];
+	uint8_t i;
+	
+	for (i = 0; i < TRANSFORM_CACHE_SIZE; i++)
+		transformCache[i].sprite = ERROR_HANDLE;
+	for (i = 0; i < sizeof(spriteHandles); i++) {
+		spriteHandles[i] = 0;
+		spriteHandlesDeleted[i] = 0;
+	}
+	
+	replyQueue = xQueueCreate(REPLY_QUEUE_SIZE, sizeof(uint8_t));
+	collisionQueue = xQueueCreate(COLLISION_QUEUE_SIZE, sizeof(xCollisionEvent));
+	
 	USART_Init(BAUD_RATE, configCPU_CLOCK_HZ);
 
 	USART_Read();
 	USART_Write_Unprotected(0xFF);
 	
-	USART_Write_Unprotected(CREATE_WINDOW);
-	USART_Write_Unprotected(width >> 8);
-	USART_Write_Unprotected(width & 0x00FF);
-	USART_Write_Unprotected(height >> 8);
-	USART_Write_Unprotected(height & 0x00FF);
+	cmd[0] = CREATE_WINDOW;
+	prvPut16(&cmd[1], width);
+	prvPut16(&cmd[3], height);
+	prvSendPacket(cmd, sizeof(cmd));
+	
+	/* The graphics context returns credit as it parses, so a burst of
+	 * commands now blocks the sender instead of overrunning the link */
+	USART_Flow_Enable(HOST_RX_WINDOW);
+}
+
+/*******************************************************************************
+* Function: prvReplyFlush
+*
+* Description: Discards reply bytes that have not been read, such as garbage
+*  received while changing baud rates.
+*******************************************************************************/
+static void prvReplyFlush(void) {
+	USART_Rx_Flush();
+	if (rxTaskRunning)
+		xQueueReset(replyQueue);
+	replyStale = 0;
+}
+
+/*******************************************************************************
+* Function: prvBaudTry
+*
+* Description: Asks the graphics context to switch to the given rate, switches
+*  the USART, and checks that the link works with a PING. If the graphics
+*  context refuses, the link stays at its current rate. If it never answers the
+*  PING, both ends go back to BAUD_RATE; the graphics context only does so
+*  after BAUD_FALLBACK_DELAY, so anything written until then is held back
+*  instead of waiting here (see USART_Flow_Resync).
+*
+* param baud: The rate to try
+* param reverted: Set to 1 if the link went back to BAUD_RATE, else 0
+* return: pdTRUE if the link is now running at the given rate
+*******************************************************************************/
+static portBASE_TYPE prvBaudTry(uint32_t baud, uint8_t *reverted) {
+	uint8_t cmd[3];
+	uint8_t i;
+	
+	*reverted = 0;
+	cmd[0] = SET_BAUD;
+	prvPut16(&cmd[1], baud / 1000);
+	prvQueryBegin();
+	prvSendPacket(cmd, sizeof(cmd));
+	if (prvReadReply() != BAUD_ACCEPTED)
+		return pdFALSE;
+	
+	USART_Set_Baud(baud, configCPU_CLOCK_HZ);
+	prvReplyFlush();
+	
+	for (i = 0; i < BAUD_PROBE_TRIES; i++) {
+		vTaskDelay(BAUD_SWITCH_DELAY);
+		cmd[0] = PING;
+		prvQueryBegin();
+		prvSendPacket(cmd, 1);
+		if (prvReadReply() == PING) {
+			/* Credit in flight during the switch may have been lost */
+			USART_Flow_Enable(HOST_RX_WINDOW);
+			return pdTRUE;
+		}
+	}
+	
+	/* The graphics context reverts on its own once no packets arrive, and its
+	 * first credit record at BAUD_RATE releases what was written meanwhile */
+	USART_Set_Baud(BAUD_RATE, configCPU_CLOCK_HZ);
+	USART_Flow_Resync();
+	replyStale = 1;
+	transformResync = 1;
+	*reverted = 1;
+	
+	return pdFALSE;
+}
+
+/*******************************************************************************
+* Function: prvBaudStepDown
+*
+* Description: Moves the link to the next slower rate in baudRates that the
+*  graphics context accepts. If a switch fails the link stays at BAUD_RATE,
+*  since trying another rate would mean waiting for the graphics context to
+*  revert first.
+*******************************************************************************/
+static void prvBaudStepDown(void) {
+	uint8_t reverted;
+	
+	while (++baudLevel < BAUD_RATE_COUNT) {
+		if (prvBaudTry(baudRates[baudLevel], &reverted))
+			break;
+		if (reverted) {
+			baudLevel = BAUD_RATE_COUNT;
+			break;
+		}
+	}
+	packetDrops = 0;
+	dropFrames = 0;
+}
+
+/*******************************************************************************
+* Function: ulGraphicsNegotiateBaud
+*
+* Description: Moves the link to the graphics context from BAUD_RATE to the
+*  fastest rate both ends can sustain. Call it once from a task, after
+*  vWindowCreate and before drawing. If packets are dropped often at the new
+*  rate, vFrameEnd later steps down to the next slower rate on its own.
+*
+* return: The baud rate now in use
+*******************************************************************************/
+uint32_t ulGraphicsNegotiateBaud(void) {
+	uint8_t reverted;
+	
+	for (baudLevel = 0; baudLevel < BAUD_RATE_COUNT; baudLevel++) {
+		if (prvBaudTry(baudRates[baudLevel], &reverted))
+			break;
+		/* The next SET_BAUD would be held back past its reply timeout */
+		if (reverted)
+			vTaskDelay(BAUD_FALLBACK_DELAY);
+	}
+	packetDrops = 0;
+	dropFrames = 0;
+	
+	return baudLevel < BAUD_RATE_COUNT ? baudRates[baudLevel] : BAUD_RATE;
+}
+
+/*******************************************************************************
+* Function: xImageRegister
+*
+* Description: Assigns an image ID to an external image file so sprites can be
+*  created from it without resending the filename. Register each image once,
+*  typically at startup; IDs are never reused. If the graphics context cannot
+*  load the file it reports STATUS_REGISTER_FAILED through uGraphicsStatus.
+*
+* param filename: Null-terminated string containing the name of the image file
+*  in the external graphics context.
+* return: The new image ID on success; ERROR_HANDLE if no IDs are left or the
+*  filename is too long to fit in a packet
+*******************************************************************************/
+xImageHandle xImageRegister(const char *filename) {
+	xImageHandle result;
+	uint8_t cmd[PACKET_PAYLOAD_MAX];
+	uint8_t length = strlen(filename);
+	
+	if (nextImageHandle > LAST_IMAGE_HANDLE || length > PACKET_PAYLOAD_MAX - 3)
+		return ERROR_HANDLE;
+	result = nextImageHandle++;
+	
+	cmd[0] = REGISTER_IMAGE;
+	cmd[1] = result;
+	memcpy(&cmd[2], filename, length);
+	cmd[length + 2] = 0x00;  /* Filename is null-terminated */
+	prvSendPacket(cmd, length + 3);
+	
+	return result;
+}
+
+/*******************************************************************************
+* Function: xImageRegisterFrames
+*
+* Description: Registers a list of image files under consecutive image IDs, so
+*  that a sprite created from the first can switch between them with
+*  vSpriteSetFrame. Either every file is registered or none are.
+*
+* param files: Array of null-terminated image file names, one per frame
+* param count: Number of files in the array
+* return: The image ID of the first frame on success; ERROR_HANDLE if there are
+*  not enough IDs left or a filename is too long to fit in a packet
+*******************************************************************************/
+xImageHandle xImageRegisterFrames(const char *files[], uint8_t count) {
+	xImageHandle result = nextImageHandle;
+	uint8_t i;
+	
+	if (count == 0 || LAST_IMAGE_HANDLE + 1 - nextImageHandle < count)
+		return ERROR_HANDLE;
+	for (i = 0; i < count; i++) {
+		if (strlen(files[i]) > PACKET_PAYLOAD_MAX - 3)
+			return ERROR_HANDLE;
+	}
+	
+	for (i = 0; i < count; i++)
+		xImageRegister(files[i]);
+	
+	return result;
+}
+
+/*******************************************************************************
+* Function: xImageRegisterSheet
+*
+* Description: Registers a sprite sheet: one image file holding equally wide
+*  frames side by side. The graphics context splits it once into separate
+*  frames with consecutive image IDs, to be used like those of
+*  xImageRegisterFrames. If it cannot load the file it reports
+*  STATUS_REGISTER_FAILED for the first ID through uGraphicsStatus.
+*
+* param filename: Null-terminated string containing the name of the image file
+*  in the external graphics context.
+* param frames: Number of frames in the sheet, left to right
+* return: The image ID of the first frame on success; ERROR_HANDLE if there are
+*  not enough IDs left or the filename is too long to fit in a packet
+*******************************************************************************/
+xImageHandle xImageRegisterSheet(const char *filename, uint8_t frames) {
+	xImageHandle result;
+	uint8_t cmd[PACKET_PAYLOAD_MAX];
+	uint8_t length = strlen(filename);
+	
+	if (frames == 0 || LAST_IMAGE_HANDLE + 1 - nextImageHandle < frames ||
+	 length > PACKET_PAYLOAD_MAX - 4)
+		return ERROR_HANDLE;
+	result = nextImageHandle;
+	nextImageHandle += frames;
+	
+	cmd[0] = REGISTER_SHEET;
+	cmd[1] = result;
+	cmd[2] = frames;
+	memcpy(&cmd[3], filename, length);
+	cmd[length + 3] = 0x00;  /* Filename is null-terminated */
+	prvSendPacket(cmd, length + 4);
+	
+	return result;
 }
 
 /*******************************************************************************
 * Function: xSpriteCreate
 *
 * Description: Instantiates a sprite in the external graphics context using the
-*  contents of the given external file with the given position, angle, size, and
-*  depth in the window. The window origin is in the upper-left corner.
+*  given registered image with the given position, angle, size, and depth in
+*  the window. The window origin is in the upper-left corner.
 *
-* param filename: Null-terminated string containing the name of the sprite image
-*  file in the external graphics context.
+* param image: The ID of the sprite's image, as returned by xImageRegister
 * param xPos: Initial x-position of the center of the sprite in window coords
 * param yPos: Initial y-position of the center of the sprite in window coords
 * param rAngle: Initial CCW rotation of the sprite about its center in degrees
 * param width: Initial, unrotated width of the sprite in pixels
 * param height: Initial, unrotated height of the sprite in pixels
 * param depth: Initial draw depth of the sprite (larger numbers are in front)
-* return: A valid handle to the new sprite on success; ERROR_HANDLE otherwise
+* return: A valid handle to the new sprite on success; ERROR_HANDLE if no
+*  handles are left. The handle is allocated locally and the call does not wait
+*  for the graphics context; if it fails to create the sprite it reports
+*  STATUS_CREATE_FAILED for the handle through uGraphicsStatus, and the handle
+*  must still be released with vSpriteDelete.
 *******************************************************************************/
-xSpriteHandle xSpriteCreate(const char *filename, uint16_t xPos, uint16_t yPos,
+xSpriteHandle xSpriteCreate(xImageHandle image, uint16_t xPos, uint16_t yPos,
  uint16_t rAngle, uint16_t width, uint16_t height, uint8_t depth) {
+	xSpriteHandle result = prvSpriteHandleAlloc();
+	uint8_t cmd[14];
 	
-	USART_Write(CREATE_SPRITE);
-
-	while (*filename != '\0') {
-		USART_Write((uint8_t)*filename++);
-	}
-	USART_Write(0x00);  /* Filename is null-terminated */
-
-	USART_Write(xPos >> 8);
-	USART_Write(xPos & 0x00FF);
-	USART_Write(yPos >> 8);
-	USART_Write(yPos & 0x00FF);
-	USART_Write(rAngle >> 8);
-	USART_Write(rAngle & 0x00FF);
-	USART_Write(width >> 8);
-	USART_Write(width & 0x00FF);
-	USART_Write(height >> 8);
-	USART_Write(height & 0x00FF);
-	USART_Write(depth);
+	if (result == ERROR_HANDLE)
+		return ERROR_HANDLE;
+	
+	cmd[0] = CREATE_SPRITE;
+	cmd[1] = result;
+	cmd[2] = image;
+	prvPut16(&cmd[3], xPos);
+	prvPut16(&cmd[5], yPos);
+	prvPut16(&cmd[7], rAngle);
+	prvPut16(&cmd[9], width);
+	prvPut16(&cmd[11], height);
+	cmd[13] = depth;
+	prvSendPacket(cmd, sizeof(cmd));
 	
-	PORTA = 0xAA;
-	xSpriteHandle result = (xSpriteHandle)USART_Read();
-	PORTA = 0xFF;
+	prvTransformStore(result, xPos, yPos, rAngle);
 	
 	return result;
 }
@@ -116,12 +909,29 @@ xSpriteHandle xSpriteCreate(const char *filename, uint16_t xPos, uint16_t yPos,
 * param y: New y-position of the sprite's center in window coordinates
 *******************************************************************************/
 void vSpriteSetPosition(xSpriteHandle sprite, uint16_t x, uint16_t y) {
-	USART_Write(SET_POS);
-	USART_Write(sprite);
-	USART_Write(x >> 8);
-	USART_Write(x & 0x00FF);
-	USART_Write(y >> 8);
-	USART_Write(y & 0x00FF);
+	frameRecord *record;
+	transformBase *base;
+	uint8_t cmd[6];
+	
+	if (frameOpen) {
+		record = prvFrameRecord(sprite);
+		record->mask |= FIELD_POS;
+		record->x = x;
+		record->y = y;
+		return;
+	}
+	
+	base = prvTransformBase(sprite);
+	if (base != NULL) {
+		base->x = x;
+		base->y = y;
+	}
+	
+	cmd[0] = SET_POS;
+	cmd[1] = sprite;
+	prvPut16(&cmd[2], x);
+	prvPut16(&cmd[4], y);
+	prvSendPacket(cmd, sizeof(cmd));
 }
 
 /*******************************************************************************
@@ -133,10 +943,168 @@ void vSpriteSetPosition(xSpriteHandle sprite, uint16_t x, uint16_t y) {
 * param angle: Angle in degrees to rotate the sprite CCW about its center
 *******************************************************************************/
 void vSpriteSetRotation(xSpriteHandle sprite, uint16_t angle) {
-	USART_Write(SET_ROT);
-	USART_Write(sprite);
-	USART_Write(angle >> 8);
-	USART_Write(angle & 0x00FF);
+	frameRecord *record;
+	transformBase *base;
+	uint8_t cmd[4];
+	
+	if (frameOpen) {
+		record = prvFrameRecord(sprite);
+		record->mask |= FIELD_ROT;
+		record->angle = angle;
+		return;
+	}
+	
+	base = prvTransformBase(sprite);
+	if (base != NULL)
+		base->angle = angle;
+	
+	cmd[0] = SET_ROT;
+	cmd[1] = sprite;
+	prvPut16(&cmd[2], angle);
+	prvSendPacket(cmd, sizeof(cmd));
+}
+
+/*******************************************************************************
+* Function: vSpriteSetTransform
+*
+* Description: Sets the given sprite's position and rotation with a single
+*  command. Each value is sent as a signed delta from the last value sent for
+*  the sprite, and unchanged values are omitted, so a moving sprite typically
+*  costs 3-4 bytes. Falls back to sending full values when the sprite's last
+*  transform is not cached or the deltas would be longer.
+*
+* param sprite: The handle to the sprite
+* param x: New x-position of the sprite's center in window coordinates
+* param y: New y-position of the sprite's center in window coordinates
+* param angle: Angle in degrees to rotate the sprite CCW about its center
+*******************************************************************************/
+void vSpriteSetTransform(xSpriteHandle sprite, uint16_t x, uint16_t y,
+ uint16_t angle) {
+	transformBase *base;
+	int16_t dx, dy, dAngle;
+	uint8_t flags = 0, deltaLength = 0;
+	uint8_t cmd[8];
+	uint8_t *out;
+	
+	if (frameOpen) {
+		vSpriteSetRotation(sprite, angle);
+		vSpriteSetPosition(sprite, x, y);
+		return;
+	}
+	
+	base = prvTransformBase(sprite);
+	if (base == NULL) {
+		cmd[0] = SET_TRANSFORM | XFORM_FULL;
+		cmd[1] = sprite;
+		prvPut16(&cmd[2], x);
+		prvPut16(&cmd[4], y);
+		prvPut16(&cmd[6], angle);
+		prvSendPacket(cmd, sizeof(cmd));
+		prvTransformStore(sprite, x, y, angle);
+		return;
+	}
+	
+	dx = x - base->x;
+	dy = y - base->y;
+	dAngle = angle - base->angle;
+	if (dx != 0) {
+		flags |= XFORM_X;
+		deltaLength += prvVarintLength(dx);
+	}
+	if (dy != 0) {
+		flags |= XFORM_Y;
+		deltaLength += prvVarintLength(dy);
+	}
+	if (dAngle != 0) {
+		flags |= XFORM_ANGLE;
+		deltaLength += prvVarintLength(dAngle);
+	}
+	
+	if (flags == 0)
+		return;
+	
+	base->x = x;
+	base->y = y;
+	base->angle = angle;
+	
+	if (deltaLength > 6) {
+		cmd[0] = SET_TRANSFORM | XFORM_FULL;
+		cmd[1] = sprite;
+		prvPut16(&cmd[2], x);
+		prvPut16(&cmd[4], y);
+		prvPut16(&cmd[6], angle);
+		prvSendPacket(cmd, sizeof(cmd));
+		return;
+	}
+	
+	out = cmd;
+	*out++ = SET_TRANSFORM | flags;
+	*out++ = sprite;
+	if (flags & XFORM_X)
+		out = prvPutVarint(out, dx);
+	if (flags & XFORM_Y)
+		out = prvPutVarint(out, dy);
+	if (flags & XFORM_ANGLE)
+		out = prvPutVarint(out, dAngle);
+	prvSendPacket(cmd, out - cmd);
+}
+
+/*******************************************************************************
+* Function: vSpriteSetVelocity
+*
+* Description: Sets the velocity the graphics context moves the given sprite at
+*  on its own, every time it renders. A sprite flying in a straight line costs
+*  nothing to keep moving once this is sent; call it again, or set the
+*  position, only when the sprite's path changes. Positions set afterwards
+*  (including deltas) are where the sprite continues from.
+*
+* param sprite: The handle to the sprite
+* param vx: Horizontal velocity in pixels per second (positive is right)
+* param vy: Vertical velocity in pixels per second (positive is down)
+*******************************************************************************/
+void vSpriteSetVelocity(xSpriteHandle sprite, int16_t vx, int16_t vy) {
+	frameRecord *record;
+	uint8_t cmd[6];
+	
+	if (frameOpen) {
+		record = prvFrameRecord(sprite);
+		record->mask |= FIELD_VELOCITY;
+		record->vx = vx;
+		record->vy = vy;
+		return;
+	}
+	
+	cmd[0] = SET_VELOCITY;
+	cmd[1] = sprite;
+	prvPut16(&cmd[2], vx);
+	prvPut16(&cmd[4], vy);
+	prvSendPacket(cmd, sizeof(cmd));
+}
+
+/*******************************************************************************
+* Function: vSpriteSetAngularVelocity
+*
+* Description: Sets the rate the graphics context rotates the given sprite at
+*  on its own, every time it renders (see vSpriteSetVelocity).
+*
+* param sprite: The handle to the sprite
+* param rate: Angular velocity in degrees per second CCW (negative is CW)
+*******************************************************************************/
+void vSpriteSetAngularVelocity(xSpriteHandle sprite, int16_t rate) {
+	frameRecord *record;
+	uint8_t cmd[4];
+	
+	if (frameOpen) {
+		record = prvFrameRecord(sprite);
+		record->mask |= FIELD_ANGULAR_VEL;
+		record->angularVel = rate;
+		return;
+	}
+	
+	cmd[0] = SET_ANGULAR_VELOCITY;
+	cmd[1] = sprite;
+	prvPut16(&cmd[2], rate);
+	prvSendPacket(cmd, sizeof(cmd));
 }
 
 /*******************************************************************************
@@ -149,12 +1117,22 @@ void vSpriteSetRotation(xSpriteHandle sprite, uint16_t angle) {
 * param height: New height of the sprite in pixels before applying rotation
 *******************************************************************************/
 void vSpriteSetSize(xSpriteHandle sprite, uint16_t width, uint16_t height) {
-	USART_Write(SET_SIZE);
-	USART_Write(sprite);
-	USART_Write(width >> 8);
-	USART_Write(width & 0x00FF);
-	USART_Write(height >> 8);
-	USART_Write(height & 0x00FF);
+	frameRecord *record;
+	uint8_t cmd[6];
+	
+	if (frameOpen) {
+		record = prvFrameRecord(sprite);
+		record->mask |= FIELD_SIZE;
+		record->width = width;
+		record->height = height;
+		return;
+	}
+	
+	cmd[0] = SET_SIZE;
+	cmd[1] = sprite;
+	prvPut16(&cmd[2], width);
+	prvPut16(&cmd[4], height);
+	prvSendPacket(cmd, sizeof(cmd));
 }
 
 /*******************************************************************************
@@ -166,22 +1144,518 @@ void vSpriteSetSize(xSpriteHandle sprite, uint16_t width, uint16_t height) {
 * param depth: New draw depth (larger depths are in front of smaller depths)
 *******************************************************************************/
 void vSpriteSetDepth(xSpriteHandle sprite, uint8_t depth) {
-	USART_Write(SET_ORDER);
-	USART_Write(sprite);
-	USART_Write(depth);
+	frameRecord *record;
+	uint8_t cmd[3];
+	
+	if (frameOpen) {
+		record = prvFrameRecord(sprite);
+		record->mask |= FIELD_DEPTH;
+		record->depth = depth;
+		return;
+	}
+	
+	cmd[0] = SET_ORDER;
+	cmd[1] = sprite;
+	cmd[2] = depth;
+	prvSendPacket(cmd, sizeof(cmd));
+}
+
+/*******************************************************************************
+* Function: vSpriteSetFrame
+*
+* Description: Shows another frame of the given sprite's image, keeping its
+*  position, rotation, size and depth. Frame 0 is the image the sprite was
+*  created with; frame n is the image registered n IDs after it (see
+*  xImageRegisterFrames and xImageRegisterSheet). The graphics context keeps
+*  each frame it has drawn, so switching back and forth costs no image loads.
+*  Frame changes are not batched and take effect as soon as they are received.
+*
+* param sprite: The handle to the sprite
+* param frame: Index of the frame to show
+*******************************************************************************/
+void vSpriteSetFrame(xSpriteHandle sprite, uint8_t frame) {
+	uint8_t cmd[3];
+	
+	cmd[0] = SET_FRAME;
+	cmd[1] = sprite;
+	cmd[2] = frame;
+	prvSendPacket(cmd, sizeof(cmd));
+}
+
+/*******************************************************************************
+* Function: vSpriteSetScreenSpace
+*
+* Description: Chooses whether the given sprite is placed in the world, where
+*  the camera moves and zooms it (see vCameraSet), or on the screen, where it
+*  stays put regardless of the camera. Sprites start in the world; HUD
+*  elements such as scores belong on the screen. Takes effect as soon as it is
+*  received, even inside a frame.
+*
+* param sprite: The handle to the sprite
+* param screen: Nonzero for screen coordinates; 0 for world coordinates
+*******************************************************************************/
+void vSpriteSetScreenSpace(xSpriteHandle sprite, uint8_t screen) {
+	uint8_t cmd[3];
+	
+	cmd[0] = SET_SCREEN_SPACE;
+	cmd[1] = sprite;
+	cmd[2] = screen ? 1 : 0;
+	prvSendPacket(cmd, sizeof(cmd));
+}
+
+/*******************************************************************************
+* Function: vSpriteAttach
+*
+* Description: Attaches a sprite to a parent sprite, so that the graphics
+*  context moves it along with the parent and one update to the parent moves
+*  the whole assembly. While attached, the child's own position is ignored; with
+*  ATTACH_ROTATE, its angle is relative to the parent's. Deleting the parent
+*  detaches its children where they are. Takes effect as soon as it is
+*  received, even inside a frame.
+*
+* param child: The handle to the sprite to attach
+* param parent: The handle to the sprite to follow, or ERROR_HANDLE to detach
+*  the child, leaving it where it is
+* param dx: Horizontal offset of the child's center from the parent's center
+* param dy: Vertical offset of the child's center from the parent's center
+* param flags: ATTACH_ROTATE to turn the offset and the child with the parent;
+*  0 to keep the offset and the child's angle fixed, as for a label
+*******************************************************************************/
+void vSpriteAttach(xSpriteHandle child, xSpriteHandle parent, int16_t dx,
+ int16_t dy, uint8_t flags) {
+	uint8_t cmd[8];
+	
+	cmd[0] = ATTACH;
+	cmd[1] = child;
+	cmd[2] = parent;
+	cmd[3] = flags;
+	prvPut16(&cmd[4], dx);
+	prvPut16(&cmd[6], dy);
+	prvSendPacket(cmd, sizeof(cmd));
 }
 
 /*******************************************************************************
 * Function: vSpriteDelete
 *
 * Description: Removes the sprite from the window and invalidates the given
-*  handle.
+*  handle. A handle deleted while a frame is open is not handed out again until
+*  vFrameEnd, since records for it may already have been sent.
 *
 * param sprite: The handle to the sprite to be deleted
 *******************************************************************************/
 void vSpriteDelete(xSpriteHandle sprite) {
-	USART_Write(DELETE_SPRITE);
-	USART_Write(sprite);
+	transformBase *base = prvTransformBase(sprite);
+	uint8_t cmd[2];
+	
+	if (base != NULL)
+		base->sprite = ERROR_HANDLE;
+	if (frameOpen)
+		prvFrameDiscard(sprite);
+	
+	cmd[0] = DELETE_SPRITE;
+	cmd[1] = sprite;
+	prvSendPacket(cmd, sizeof(cmd));
+	
+	if (frameOpen && sprite >= FIRST_SPRITE_HANDLE &&
+	 sprite <= LAST_SPRITE_HANDLE)
+		spriteHandlesDeleted[sprite >> 3] |= 1 << (sprite & 0x07);
+	else
+		prvSpriteHandleFree(sprite);
+}
+
+/*******************************************************************************
+* Function: vSpriteSetVisible
+*
+* Description: Shows or hides the given sprite. A hidden sprite keeps its
+*  handle, position and groups but is not drawn and collides with nothing.
+*
+* param sprite: The handle to the sprite
+* param visible: Nonzero to show the sprite; 0 to hide it
+*******************************************************************************/
+void vSpriteSetVisible(xSpriteHandle sprite, uint8_t visible) {
+	frameRecord *record;
+	uint8_t cmd[3];
+	
+	visible = visible ? 1 : 0;
+	if (frameOpen) {
+		record = prvFrameRecord(sprite);
+		record->mask |= FIELD_VISIBLE;
+		record->visible = visible;
+		return;
+	}
+	
+	cmd[0] = SET_VISIBLE;
+	cmd[1] = sprite;
+	cmd[2] = visible;
+	prvSendPacket(cmd, sizeof(cmd));
+}
+
+/*******************************************************************************
+* Function: xSpritePoolCreate
+*
+* Description: Creates a pool of hidden sprites sharing one image, for objects
+*  that come and go often such as bullets. Taking a sprite from the pool and
+*  giving it back only moves and shows or hides it, where creating and deleting
+*  a sprite makes the graphics context rebuild its image each time.
+*
+* param image: The registered image ID used for every sprite in the pool
+* param count: Number of sprites in the pool (at most SPRITE_POOL_MAX)
+* param width: Width of each sprite in pixels before applying rotation
+* param height: Height of each sprite in pixels before applying rotation
+* param depth: Draw depth of each sprite (larger numbers are in front)
+* param group: Group every sprite in the pool is added to, or ERROR_HANDLE
+* return: A valid handle to the new pool on success; ERROR_HANDLE if no pools
+*  or sprite handles are left
+*******************************************************************************/
+xSpritePoolHandle xSpritePoolCreate(xImageHandle image, uint8_t count,
+ uint16_t width, uint16_t height, uint8_t depth, xGroupHandle group) {
+	spritePool *pool;
+	xSpritePoolHandle result;
+	xSpriteHandle sprite;
+	
+	if (count == 0 || count > SPRITE_POOL_MAX)
+		return ERROR_HANDLE;
+	for (result = 0; result < SPRITE_POOL_COUNT; result++) {
+		if (spritePools[result].count == 0)
+			break;
+	}
+	if (result == SPRITE_POOL_COUNT)
+		return ERROR_HANDLE;
+	
+	pool = &spritePools[result];
+	pool->freeCount = 0;
+	while (pool->freeCount < count) {
+		sprite = xSpriteCreate(image, 0, 0, 0, width, height, depth);
+		if (sprite == ERROR_HANDLE)
+			break;
+		vSpriteSetVisible(sprite, 0);
+		if (group != ERROR_HANDLE)
+			vGroupAddSprite(group, sprite);
+		pool->sprites[pool->freeCount++] = sprite;
+	}
+	
+	if (pool->freeCount < count) {
+		while (pool->freeCount > 0)
+			vSpriteDelete(pool->sprites[--pool->freeCount]);
+		return ERROR_HANDLE;
+	}
+	pool->count = count;
+	
+	return result;
+}
+
+/*******************************************************************************
+* Function: xSpritePoolAcquire
+*
+* Description: Takes a sprite from the pool and shows it at the given place.
+*
+* param pool: The handle to the pool
+* param x: The x-position of the sprite's center in window coordinates
+* param y: The y-position of the sprite's center in window coordinates
+* param angle: Angle in degrees to rotate the sprite CCW about its center
+* return: The handle to the sprite, or ERROR_HANDLE if the pool is empty
+*******************************************************************************/
+xSpriteHandle xSpritePoolAcquire(xSpritePoolHandle pool, uint16_t x,
+ uint16_t y, uint16_t angle) {
+	xSpriteHandle sprite;
+	
+	if (pool >= SPRITE_POOL_COUNT || spritePools[pool].freeCount == 0)
+		return ERROR_HANDLE;
+	
+	sprite = spritePools[pool].sprites[--spritePools[pool].freeCount];
+	vSpriteSetTransform(sprite, x, y, angle);
+	vSpriteSetVisible(sprite, 1);
+	
+	return sprite;
+}
+
+/*******************************************************************************
+* Function: vSpritePoolRelease
+*
+* Description: Hides a sprite taken from the pool, stops it moving, and returns
+*  it to the pool. Sprites that are not in use from this pool are ignored.
+*
+* param pool: The handle to the pool
+* param sprite: The handle to the sprite being returned
+*******************************************************************************/
+void vSpritePoolRelease(xSpritePoolHandle pool, xSpriteHandle sprite) {
+	spritePool *p;
+	uint8_t i;
+	
+	if (pool >= SPRITE_POOL_COUNT)
+		return;
+	p = &spritePools[pool];
+	
+	for (i = p->freeCount; i < p->count; i++) {
+		if (p->sprites[i] == sprite) {
+			p->sprites[i] = p->sprites[p->freeCount];
+			p->sprites[p->freeCount++] = sprite;
+			vSpriteSetVisible(sprite, 0);
+			vSpriteSetVelocity(sprite, 0, 0);
+			vSpriteSetAngularVelocity(sprite, 0);
+			return;
+		}
+	}
+}
+
+/*******************************************************************************
+* Function: vSpritePoolDelete
+*
+* Description: Deletes every sprite in the pool, whether in use or not, and
+*  invalidates the given handle.
+*
+* param pool: The handle to the pool to be deleted
+*******************************************************************************/
+void vSpritePoolDelete(xSpritePoolHandle pool) {
+	spritePool *p;
+	uint8_t i;
+	
+	if (pool >= SPRITE_POOL_COUNT)
+		return;
+	p = &spritePools[pool];
+	
+	for (i = 0; i < p->count; i++)
+		vSpriteDelete(p->sprites[i]);
+	p->count = 0;
+	p->freeCount = 0;
+}
+
+/*******************************************************************************
+* Function: xTextCreate
+*
+* Description: Instantiates an empty text sprite, which the external graphics
+*  context draws from cached glyphs instead of an image file. Set its text with
+*  vTextSet. It is an ordinary sprite otherwise: it can be moved, rotated,
+*  hidden and deleted with the other sprite functions, and it is as wide and
+*  tall as its current text unless given a size with vSpriteSetSize.
+*
+* param font: Index of the font in the graphics context's font table
+* param size: Height of the font in pixels
+* param x: Initial x-position of the center of the text in window coords
+* param y: Initial y-position of the center of the text in window coords
+* param depth: Initial draw depth of the text (larger numbers are in front)
+* return: A valid handle to the new text sprite on success; ERROR_HANDLE if no
+*  handles are left. Failures are reported as for xSpriteCreate.
+*******************************************************************************/
+xSpriteHandle xTextCreate(uint8_t font, uint8_t size, uint16_t x, uint16_t y,
+ uint8_t depth) {
+	xSpriteHandle result = prvSpriteHandleAlloc();
+	uint8_t cmd[9];
+	
+	if (result == ERROR_HANDLE)
+		return ERROR_HANDLE;
+	
+	cmd[0] = CREATE_TEXT;
+	cmd[1] = result;
+	cmd[2] = font;
+	cmd[3] = size;
+	prvPut16(&cmd[4], x);
+	prvPut16(&cmd[6], y);
+	cmd[8] = depth;
+	prvSendPacket(cmd, sizeof(cmd));
+	
+	prvTransformStore(result, x, y, 0);
+	
+	return result;
+}
+
+/*******************************************************************************
+* Function: vTextSet
+*
+* Description: Changes the string shown by a text sprite. The graphics context
+*  only redraws the sprite when the string actually changes. Strings longer
+*  than a packet are truncated.
+*
+* param text: The handle to the text sprite
+* param s: The null-terminated string to show
+*******************************************************************************/
+void vTextSet(xSpriteHandle text, const char *s) {
+	uint8_t cmd[PACKET_PAYLOAD_MAX];
+	uint8_t length = strnlen(s, PACKET_PAYLOAD_MAX - 3);
+	
+	cmd[0] = SET_TEXT;
+	cmd[1] = text;
+	memcpy(&cmd[2], s, length);
+	cmd[length + 2] = 0x00;  /* string is null-terminated */
+	prvSendPacket(cmd, length + 3);
+}
+
+/*******************************************************************************
+* Function: xTilemapLoad
+*
+* Description: Has the external graphics context load a Tiled map (.tmx) and
+*  draw all of its tile layers as one static sprite, with its upper-left corner
+*  at the window origin. The sprite collides only where the map has solid
+*  tiles: tiles with a "solid" property, or any tile in a layer with one. Add
+*  the sprite to a group to test or subscribe to collisions against the walls.
+*  The map's solid tiles are also sent back once so they can be tested
+*  locally. Waits for the graphics context to finish loading.
+*
+* param filename: Null-terminated string containing the name of the .tmx file
+*  in the external graphics context.
+* param depth: Draw depth of the map (larger numbers are in front)
+* param map: Filled with the map's dimensions and its solid tiles, up to the
+*  size of map->solid (see uTilemapSolid). map->solid and map->solidSize must
+*  be set by the caller.
+* return: A valid handle to the map sprite on success; ERROR_HANDLE if no
+*  handles are left, the filename is too long to fit in a packet, or the
+*  graphics context could not load the map
+*******************************************************************************/
+xSpriteHandle xTilemapLoad(const char *filename, uint8_t depth,
+ xTilemap *map) {
+	xSpriteHandle result;
+	uint8_t cmd[PACKET_PAYLOAD_MAX];
+	uint8_t length = strlen(filename);
+	uint16_t tiles, tile, i;
+	uint8_t bits, bit;
+	
+	if (length > PACKET_PAYLOAD_MAX - 4)
+		return ERROR_HANDLE;
+	result = prvSpriteHandleAlloc();
+	if (result == ERROR_HANDLE)
+		return ERROR_HANDLE;
+	
+	cmd[0] = LOAD_TILEMAP;
+	cmd[1] = result;
+	cmd[2] = depth;
+	memcpy(&cmd[3], filename, length);
+	cmd[length + 3] = 0x00;  /* Filename is null-terminated */
+	prvQueryBegin();
+	prvSendPacket(cmd, length + 4);
+	
+	/* Width and height in tiles, then tile width and height in pixels; a width
+	 * of 0 means the map could not be loaded */
+	map->width = prvReadReply();
+	if (map->width == 0 || map->width == ERROR_HANDLE) {
+		vSpriteDelete(result);
+		return ERROR_HANDLE;
+	}
+	map->height = prvReadReply();
+	map->tileWidth = prvReadReply();
+	map->tileHeight = prvReadReply();
+	
+	/* Solid tiles follow row by row, packed seven to a byte so that no byte
+	 * can be mistaken for a status record */
+	memset(map->solid, 0, map->solidSize);
+	tiles = map->width * map->height;
+	for (tile = 0; tile < tiles; tile += TILEMAP_BITS_PER_BYTE) {
+		bits = prvReadReply();
+		if (bits == ERROR_HANDLE)
+			break;
+		for (bit = 0; bit < TILEMAP_BITS_PER_BYTE; bit++) {
+			i = tile + bit;
+			if ((bits & (1 << bit)) && (i >> 3) < map->solidSize)
+				map->solid[i >> 3] |= 1 << (i & 0x07);
+		}
+	}
+	
+	prvTransformStore(result, (map->width * map->tileWidth) >> 1,
+	 (map->height * map->tileHeight) >> 1, 0);
+	
+	return result;
+}
+
+/*******************************************************************************
+* Function: uTilemapSolid
+*
+* Description: Tests whether a tile of a map loaded with xTilemapLoad is solid.
+*
+* param map: The map filled in by xTilemapLoad
+* param col: Column of the tile, from the left
+* param row: Row of the tile, from the top
+* return: 1 if the tile is solid; 0 if it is not, is outside the map, or did
+*  not fit in map->solid
+*******************************************************************************/
+uint8_t uTilemapSolid(const xTilemap *map, uint8_t col, uint8_t row) {
+	uint16_t i = row * map->width + col;
+	
+	if (col >= map->width || row >= map->height || (i >> 3) >= map->solidSize)
+		return 0;
+	
+	return (map->solid[i >> 3] >> (i & 0x07)) & 0x01;
+}
+
+/*******************************************************************************
+* Function: vCameraSet
+*
+* Description: Moves the view of the world shown in the window. Every sprite in
+*  world coordinates is drawn relative to the camera, so scrolling a world
+*  larger than the window costs this one command per frame however many
+*  sprites there are. Inside a frame the move is applied together with the
+*  frame's other changes.
+*
+* param x: World x-coordinate shown at the window's upper-left corner
+* param y: World y-coordinate shown at the window's upper-left corner
+* param zoom: Scale from world to window pixels in 1/256ths (CAMERA_ZOOM_1X is
+*  no zoom), about the window's upper-left corner
+*******************************************************************************/
+void vCameraSet(uint16_t x, uint16_t y, uint16_t zoom) {
+	uint8_t cmd[7];
+	
+	if (frameOpen) {
+		cameraPending = 1;
+		cameraX = x;
+		cameraY = y;
+		cameraZoom = zoom;
+		return;
+	}
+	
+	cmd[0] = SET_CAMERA;
+	prvPut16(&cmd[1], x);
+	prvPut16(&cmd[3], y);
+	prvPut16(&cmd[5], zoom);
+	prvSendPacket(cmd, sizeof(cmd));
+}
+
+/*******************************************************************************
+* Function: vFrameBegin
+*
+* Description: Starts batching sprite updates. Until vFrameEnd is called, the
+*  position, rotation, size, depth, velocity and visibility setters only record
+*  which fields changed; the changes are sent as one compact batch and applied by the
+*  external graphics context in a single render pass. Note that collision tests
+*  made while a frame is open see the sprites as of the previous frame.
+*******************************************************************************/
+void vFrameBegin(void) {
+	frameRecordCount = 0;
+	cameraPending = 0;
+	frameOpen = 1;
+}
+
+/*******************************************************************************
+* Function: vFrameEnd
+*
+* Description: Sends all sprite updates batched since vFrameBegin and tells the
+*  external graphics context to apply them atomically. Drops the link to a
+*  slower rate if the graphics context has been losing packets.
+*******************************************************************************/
+void vFrameEnd(void) {
+	uint8_t cmd = END_FRAME;
+	uint8_t i;
+	
+	prvFrameFlush();
+	frameOpen = 0;
+	
+	if (cameraPending) {
+		cameraPending = 0;
+		vCameraSet(cameraX, cameraY, cameraZoom);
+	}
+	
+	prvSendPacket(&cmd, 1);
+	
+	/* The frame's records have been applied, so deleted handles can be reused */
+	for (i = 0; i < sizeof(spriteHandles); i++) {
+		spriteHandles[i] &= ~spriteHandlesDeleted[i];
+		spriteHandlesDeleted[i] = 0;
+	}
+	
+	if (baudLevel < BAUD_RATE_COUNT && packetDrops >= BAUD_DROP_LIMIT) {
+		prvBaudStepDown();
+	}
+	else if (++dropFrames >= BAUD_DROP_FRAMES) {
+		packetDrops = 0;
+		dropFrames = 0;
+	}
 }
 
 /*******************************************************************************
@@ -193,8 +1667,11 @@ void vSpriteDelete(xSpriteHandle sprite) {
 * return: A valid handle to the new group on success; ERROR_HANDLE otherwise
 *******************************************************************************/
 xGroupHandle xGroupCreate(void) {
-	USART_Write(CREATE_GROUP);
-	xGroupHandle result = (xGroupHandle)USART_Read();
+	uint8_t cmd = CREATE_GROUP;
+	
+	prvQueryBegin();
+	prvSendPacket(&cmd, 1);
+	xGroupHandle result = (xGroupHandle)prvReadReply();
 	
 	return result;
 }
@@ -208,9 +1685,12 @@ xGroupHandle xGroupCreate(void) {
 * param sprite: The handle to the sprite to add to the group
 *******************************************************************************/
 void vGroupAddSprite(xGroupHandle group, xSpriteHandle sprite) {
-	USART_Write(ADD_TO_GROUP);
-	USART_Write(group);
-	USART_Write(sprite);
+	uint8_t cmd[3];
+	
+	cmd[0] = ADD_TO_GROUP;
+	cmd[1] = group;
+	cmd[2] = sprite;
+	prvSendPacket(cmd, sizeof(cmd));
 }
 
 /*******************************************************************************
@@ -222,9 +1702,12 @@ void vGroupAddSprite(xGroupHandle group, xSpriteHandle sprite) {
 * param sprite: The handle to the sprite to remove from the group
 *******************************************************************************/
 void vGroupRemoveSprite(xGroupHandle group, xSpriteHandle sprite) {
-	USART_Write(REMOVE_FROM_GROUP);
-	USART_Write(group);
-	USART_Write(sprite);
+	uint8_t cmd[3];
+	
+	cmd[0] = REMOVE_FROM_GROUP;
+	cmd[1] = group;
+	cmd[2] = sprite;
+	prvSendPacket(cmd, sizeof(cmd));
 }
 
 /*******************************************************************************
@@ -236,8 +1719,11 @@ void vGroupRemoveSprite(xGroupHandle group, xSpriteHandle sprite) {
 * param group: The handle to the group to be deleted
 *******************************************************************************/
 void vGroupDelete(xGroupHandle group) {
-	USART_Write(DELETE_GROUP);
-	USART_Write(group);
+	uint8_t cmd[2];
+	
+	cmd[0] = DELETE_GROUP;
+	cmd[1] = group;
+	prvSendPacket(cmd, sizeof(cmd));
 }
 
 /*******************************************************************************
@@ -258,21 +1744,213 @@ void vGroupDelete(xGroupHandle group) {
 uint8_t uCollide(xSpriteHandle sprite, xGroupHandle group,
  xSpriteHandle hits[], uint8_t hitsSize) {
 	uint8_t hitCount = 0;
+	uint8_t cmd[3];
 	
-	USART_Write(COLLIDE);
-	USART_Write(sprite);
-	USART_Write(group);
+	cmd[0] = COLLIDE;
+	cmd[1] = sprite;
+	cmd[2] = group;
+	prvQueryBegin();
+	prvSendPacket(cmd, sizeof(cmd));
 	
 	while (hitCount < hitsSize) {
-		hits[hitCount] = USART_Read();
+		hits[hitCount] = prvReadReply();
 		if (hits[hitCount] == ERROR_HANDLE) {
 			return hitCount;
 		}
 		hitCount++;
 	}
 	
-	while (USART_Read() != ERROR_HANDLE)
+	while (prvReadReply() != ERROR_HANDLE)
 	    hitCount++;
 		
 	return hitCount;
-}	
\ No newline at end of file
+}	
+
+/*******************************************************************************
+* Function: xCollideBatch
+*
+* Description: Runs several collision tests with a single request to the
+*  graphics context. Each query tests one sprite against one group exactly as
+*  uCollide does, and on return holds the hits for that sprite.
+*
+* param queries: The tests to run; each query's hits and hitCount are filled in
+* param count: The number of queries
+* return: pdTRUE if any query collided with anything; pdFALSE otherwise
+*******************************************************************************/
+portBASE_TYPE xCollideBatch(xCollideQuery queries[], uint8_t count) {
+	portBASE_TYPE result = pdFALSE;
+	xCollideQuery *query;
+	xSpriteHandle hit;
+	uint8_t cmd[PACKET_PAYLOAD_MAX];
+	uint8_t *out = &cmd[2];
+	uint8_t i;
+	
+	if (count == 0)
+		return pdFALSE;
+	prvQueryBegin();
+	
+	/* Queries that do not fit in one packet continue in another batch; the
+	 * hit lists still come back in query order */
+	for (i = 0; i < count; i++) {
+		*out++ = queries[i].sprite;
+		*out++ = queries[i].group;
+		if (i + 1 == count || out - cmd > PACKET_PAYLOAD_MAX - 2) {
+			cmd[0] = COLLIDE_BATCH;
+			cmd[1] = (out - cmd - 2) / 2;
+			prvSendPacket(cmd, out - cmd);
+			out = &cmd[2];
+		}
+	}
+	
+	for (i = 0; i < count; i++)
+		queries[i].hitCount = 0;
+	
+	/* One hit list per query, each terminated by ERROR_HANDLE. After a timeout
+	 * the rest of the batch is not waited for; those queries report no hits */
+	for (i = 0; i < count && !replyStale; i++) {
+		query = &queries[i];
+		while ((hit = prvReadReply()) != ERROR_HANDLE) {
+			if (query->hitCount < query->hitsSize)
+				query->hits[query->hitCount] = hit;
+			query->hitCount++;
+		}
+		if (query->hitCount > query->hitsSize)
+			query->hitCount = query->hitsSize;
+		if (query->hitCount > 0)
+			result = pdTRUE;
+	}
+	
+	return result;
+}
+
+/*******************************************************************************
+* Function: vCollisionSubscribe
+*
+* Description: Asks the graphics context to test every sprite in groupA against
+*  groupB on each rendered frame and to report only changes in contact: a
+*  STATUS_COLLISION_BEGIN event when two sprites start overlapping and a
+*  STATUS_COLLISION_END event when they stop. Events are read with
+*  xCollisionEventReceive. A subscription ends when either group is deleted.
+*
+* param groupA: The handle to the group whose sprites are reported first
+* param groupB: The handle to the group to test groupA's sprites against
+*******************************************************************************/
+void vCollisionSubscribe(xGroupHandle groupA, xGroupHandle groupB) {
+	uint8_t cmd[3];
+	
+	cmd[0] = SUBSCRIBE_COLLISIONS;
+	cmd[1] = groupA;
+	cmd[2] = groupB;
+	prvSendPacket(cmd, sizeof(cmd));
+}
+
+/*******************************************************************************
+* Function: vCollisionUnsubscribe
+*
+* Description: Stops the collision events started by vCollisionSubscribe for
+*  the same pair of groups.
+*
+* param groupA: The first group of the subscription
+* param groupB: The second group of the subscription
+*******************************************************************************/
+void vCollisionUnsubscribe(xGroupHandle groupA, xGroupHandle groupB) {
+	uint8_t cmd[3];
+	
+	cmd[0] = UNSUBSCRIBE_COLLISIONS;
+	cmd[1] = groupA;
+	cmd[2] = groupB;
+	prvSendPacket(cmd, sizeof(cmd));
+}
+
+/*******************************************************************************
+* Function: xCollisionEventReceive
+*
+* Description: Takes the oldest collision event from the queue filled by the
+*  graphics receive path. Events are only read promptly while the task from
+*  xGraphicsRxTaskCreate is running.
+*
+* param event: Filled with the event
+* param ticksToWait: How long to block waiting for an event
+* return: pdTRUE if an event was received; pdFALSE otherwise
+*******************************************************************************/
+portBASE_TYPE xCollisionEventReceive(xCollisionEvent *event,
+ portTickType ticksToWait) {
+	return xQueueReceive(collisionQueue, event, ticksToWait);
+}
+
+/*******************************************************************************
+* Function: uGraphicsStatus
+*
+* Description: Returns the oldest asynchronous error reported by the graphics
+*  context since the last call, such as a sprite that could not be created.
+*  Status records that have already arrived are read first, so this must be
+*  called by the task that currently owns the graphics link.
+*
+* param handle: Set to the handle the error refers to; may be NULL
+* return: The status code, or STATUS_OK if no error has been reported
+*******************************************************************************/
+uint8_t uGraphicsStatus(xSpriteHandle *handle) {
+	uint8_t status;
+	
+	while (!rxTaskRunning && USART_Available()) {
+		if (USART_Read() == STATUS_MARKER)
+			prvStatusRecord();
+	}
+	
+	portENTER_CRITICAL();
+	status = pendingStatus;
+	if (handle != NULL)
+		*handle = pendingStatusHandle;
+	
+	pendingStatus = STATUS_OK;
+	pendingStatusHandle = ERROR_HANDLE;
+	portEXIT_CRITICAL();
+	
+	return status;
+}
+
+/*******************************************************************************
+* Function: prvGraphicsRxTask
+*
+* Description: Reads everything the graphics context sends. Status records are
+*  handled as they arrive, which is what delivers collision events without
+*  anyone waiting on the link; all other bytes are passed on to the task
+*  waiting for a reply. It sleeps until the USART receives a byte.
+*
+* param vParam: This parameter is not used.
+*******************************************************************************/
+static void prvGraphicsRxTask(void *vParam) {
+	uint8_t data;
+	
+	for (;;) {
+		data = USART_Read();
+		if (data == STATUS_MARKER)
+			prvStatusRecord();
+		else
+			xQueueSendToBack(replyQueue, &data, portMAX_DELAY);
+	}
+}
+
+/*******************************************************************************
+* Function: xGraphicsRxTaskCreate
+*
+* Description: Creates the task that reads everything the graphics context
+*  sends (see prvGraphicsRxTask). Call it after vWindowCreate and before
+*  starting the scheduler, at the same priority as the task that draws. From
+*  then on replies are only read through the task, so no other task ever takes
+*  bytes from the USART.
+*
+* param priority: The priority of the new task
+* return: pdPASS if the task was created; an errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY
+*  code otherwise, in which case replies are still read directly
+*******************************************************************************/
+portBASE_TYPE xGraphicsRxTaskCreate(unsigned portBASE_TYPE priority) {
+	portBASE_TYPE result;
+	
+	result = xTaskCreate(prvGraphicsRxTask, (signed char *) "r",
+	 GRAPHICS_RX_STACK, NULL, priority, NULL);
+	if (result == pdPASS)
+		rxTaskRunning = 1;
+	
+	return result;
+}
@@ -5,21 +5,93 @@
 
 #define ERROR_HANDLE 0xFF
 #define ALL_GROUP 0x00
+#define FONT_DEFAULT 0x00
+#define CAMERA_ZOOM_1X 0x0100
+#define ATTACH_ROTATE 0x01
+
+/* Asynchronous status codes reported by the graphics context */
+#define STATUS_OK 0x00
+#define STATUS_CREATE_FAILED 0x01
+#define STATUS_REGISTER_FAILED 0x02
+#define STATUS_COLLISION_BEGIN 0x10
+#define STATUS_COLLISION_END 0x11
 
 typedef uint8_t xSpriteHandle;
 typedef uint8_t xGroupHandle;
+typedef uint8_t xImageHandle;
+typedef uint8_t xSpritePoolHandle;
+
+/* One sprite-versus-group test of a collision batch (see xCollideBatch) */
+typedef struct {
+	xSpriteHandle sprite;    /* sprite to test */
+	xGroupHandle group;      /* group to test the sprite against */
+	xSpriteHandle *hits;     /* filled with handles the sprite collided with */
+	uint8_t hitsSize;        /* size of the hits array */
+	uint8_t hitCount;        /* set to the number of hits stored in hits */
+} xCollideQuery;
+
+/* Dimensions and solid tiles of a map loaded with xTilemapLoad */
+typedef struct {
+	uint8_t width;           /* map width in tiles */
+	uint8_t height;          /* map height in tiles */
+	uint8_t tileWidth;       /* tile width in pixels */
+	uint8_t tileHeight;      /* tile height in pixels */
+	uint8_t *solid;          /* one bit per tile, row by row, LSB first */
+	uint16_t solidSize;      /* size of the solid array in bytes */
+} xTilemap;
+
+/* Contact change between two subscribed groups (see vCollisionSubscribe) */
+typedef struct {
+	uint8_t type;            /* STATUS_COLLISION_BEGIN or STATUS_COLLISION_END */
+	xSpriteHandle sprite;    /* sprite from the first group */
+	xSpriteHandle other;     /* sprite from the second group */
+} xCollisionEvent;
 
 void vPrint(const char *s);
 void vWindowCreate(uint16_t width, uint16_t height);
+uint32_t ulGraphicsNegotiateBaud(void);
+
+xImageHandle xImageRegister(const char *filename);
+xImageHandle xImageRegisterFrames(const char *files[], uint8_t count);
+xImageHandle xImageRegisterSheet(const char *filename, uint8_t frames);
 
-xSpriteHandle xSpriteCreate(const char *filename, uint16_t xPos, uint16_t yPos,
+xSpriteHandle xSpriteCreate(xImageHandle image, uint16_t xPos, uint16_t yPos,
  uint16_t rAngle, uint16_t width, uint16_t height, uint8_t order);
 void vSpriteSetPosition(xSpriteHandle sprite, uint16_t x, uint16_t y);
 void vSpriteSetRotation(xSpriteHandle sprite, uint16_t angle);
+void vSpriteSetTransform(xSpriteHandle sprite, uint16_t x, uint16_t y,
+ uint16_t angle);
+void vSpriteSetVelocity(xSpriteHandle sprite, int16_t vx, int16_t vy);
+void vSpriteSetAngularVelocity(xSpriteHandle sprite, int16_t rate);
 void vSpriteSetSize(xSpriteHandle sprite, uint16_t width, uint16_t height);
 void vSpriteSetDepth(xSpriteHandle sprite, uint8_t depth);
+void vSpriteSetVisible(xSpriteHandle sprite, uint8_t visible);
+void vSpriteSetFrame(xSpriteHandle sprite, uint8_t frame);
+void vSpriteSetScreenSpace(xSpriteHandle sprite, uint8_t screen);
+void vSpriteAttach(xSpriteHandle child, xSpriteHandle parent, int16_t dx,
+ int16_t dy, uint8_t flags);
 void vSpriteDelete(xSpriteHandle sprite);
 
+xSpritePoolHandle xSpritePoolCreate(xImageHandle image, uint8_t count,
+ uint16_t width, uint16_t height, uint8_t depth, xGroupHandle group);
+xSpriteHandle xSpritePoolAcquire(xSpritePoolHandle pool, uint16_t x,
+ uint16_t y, uint16_t angle);
+void vSpritePoolRelease(xSpritePoolHandle pool, xSpriteHandle sprite);
+void vSpritePoolDelete(xSpritePoolHandle pool);
+
+xSpriteHandle xTextCreate(uint8_t font, uint8_t size, uint16_t x, uint16_t y,
+ uint8_t depth);
+void vTextSet(xSpriteHandle text, const char *s);
+
+xSpriteHandle xTilemapLoad(const char *filename, uint8_t depth,
+ xTilemap *map);
+uint8_t uTilemapSolid(const xTilemap *map, uint8_t col, uint8_t row);
+
+void vCameraSet(uint16_t x, uint16_t y, uint16_t zoom);
+
+void vFrameBegin(void);
+void vFrameEnd(void);
+
 xGroupHandle xGroupCreate(void);
 void vGroupAddSprite(xGroupHandle group, xSpriteHandle sprite);
 void vGroupRemoveSprite(xGroupHandle group, xSpriteHandle sprite);
@@ -27,5 +99,14 @@ void vGroupDelete(xGroupHandle group);
 
 uint8_t uCollide(xSpriteHandle sprite, xGroupHandle group,
  xSpriteHandle hits[], uint8_t hitsSize);
+portBASE_TYPE xCollideBatch(xCollideQuery queries[], uint8_t count);
+
+void vCollisionSubscribe(xGroupHandle groupA, xGroupHandle groupB);
+void vCollisionUnsubscribe(xGroupHandle groupA, xGroupHandle groupB);
+portBASE_TYPE xCollisionEventReceive(xCollisionEvent *event,
+ portTickType ticksToWait);
+
+uint8_t uGraphicsStatus(xSpriteHandle *handle);
+portBASE_TYPE xGraphicsRxTaskCreate(unsigned portBASE_TYPE priority);
 
 #endif /* GRAPHICS_H_ */
\ No newline at end of file
@@ -10,16 +10,57 @@
 * Revisions:
 * 5/10/12 HAV implemented queue usage in transmit function
 * 5/10/12 HAV Added USART_Write_Task
+* Added interrupt driven receive ring buffer
+* Replaced USART_Write_Task with an interrupt driven transmit ring buffer
+* Added credit based transmit flow control
+* Added USART_Set_Baud for double speed rates
+* Added USART_Flow_Resync
 ***************************/
 #include "FreeRTOS.h"
+#include "task.h"
 #include "semphr.h"
 #include <stdlib.h>
 #include <stdint.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include "usart.h"
 
-xQueueHandle xUsartQueue;
-xSemaphoreHandle xQueueMutex;
+#define RX_BUFFER_MASK (RX_BUFFER_SIZE - 1)
+#define TX_BUFFER_MASK (TX_BUFFER_SIZE - 1)
+#define FLOW_RECORD_SIZE 4
+
+/* Receive ring buffer. Only the RX ISR writes rxHead and only the reading
+ * task writes rxTail, so neither side needs a lock. */
+static volatile uint8_t rxBuffer[RX_BUFFER_SIZE];
+static volatile uint8_t rxHead = 0;
+static volatile uint8_t rxTail = 0;
+static volatile uint8_t rxOverflows = 0;
+/* Given by the RX ISR for every byte so a reader can sleep instead of spin */
+static xSemaphoreHandle xRxSemaphore;
+
+/* Transmit ring buffer. Writers fill it inside a critical section and the
+ * UDRE ISR drains it, disabling itself when the buffer runs empty. */
+static volatile uint8_t txBuffer[TX_BUFFER_SIZE];
+static volatile uint8_t txHead = 0;
+static volatile uint8_t txTail = 0;
+/* Free space a blocked writer needs; 0 when no writer is waiting */
+static volatile uint8_t txNeeded = 0;
+static volatile uint8_t txStalls = 0;
+static xSemaphoreHandle xTxSemaphore;
+
+/* Flow control. Once enabled, the UDRE ISR only sends while fewer than
+ * txWindow bytes are unacknowledged. Credit records carry the receiver's
+ * running count of bytes received, which the RX ISR takes before they reach
+ * the ring; a lost record is made good by the next one. Counts wrap at 16 bits.
+ * While txHold is set nothing is sent until a credit record restarts the count. */
+static volatile uint8_t flowEnabled = 0;
+static volatile uint8_t txHold = 0;
+static volatile uint16_t txSent = 0;
+static volatile uint16_t txAcked = 0;
+static volatile uint16_t txWindow = 0;
+static uint8_t flowRecord[FLOW_RECORD_SIZE];
+static uint8_t flowRecordLength = 0;
+
 /************************************
 * Function: usart_init
 *
@@ -29,37 +70,333 @@ xSemaphoreHandle xQueueMutex;
 * Param buadin: The desired Baud rate.
 * Param clk_seedin: The clk speed of the ATmega328p
 ************************************/
-void USART_Init(uint16_t baudin, uint32_t clk_speedin) {
+void USART_Init(uint32_t baudin, uint32_t clk_speedin) {
     uint32_t ubrr = clk_speedin/(16UL)/baudin-1;
     UBRR0H = (unsigned char)(ubrr>>8) ;// & 0x7F;
     UBRR0L = (unsigned char)ubrr;
-    /* Enable receiver and transmitter */
-    UCSR0B = (1<<RXEN0)|(1<<TXEN0);
+    /* Enable receiver, receive complete interrupt and transmitter */
+    UCSR0B = (1<<RXEN0)|(1<<RXCIE0)|(1<<TXEN0);
     /* Set frame format: 8data, 1stop bit */
     UCSR0C = (1<<UCSZ01)|(1<<UCSZ00);
 	// clear U2X0 for Synchronous operation
     UCSR0A &= ~(1<<U2X0);
 	
-	xUsartQueue = xQueueCreate( QUEUE_SIZE, sizeof( uint8_t ));
+	vSemaphoreCreateBinary(xRxSemaphore);
+	xSemaphoreTake(xRxSemaphore, 0);
+	vSemaphoreCreateBinary(xTxSemaphore);
+	xSemaphoreTake(xTxSemaphore, 0);
+}
+
+/************************************
+* Function: USART_Set_Baud
+*
+* Description: Switches the USART to
+*        double speed mode at the given
+*        baud rate. Waits for all
+*        queued data to be sent at the
+*        old rate first, and discards
+*        anything received so far.
+*        Must be called from a task.
+*
+* Param baud: The new baud rate. With a
+*        16 MHz clock, 250000, 500000
+*        and 1000000 are exact.
+* Param clk_speed: The CPU clock speed
+************************************/
+void USART_Set_Baud(uint32_t baud, uint32_t clk_speed) {
+    uint16_t ubrr = clk_speed/(8UL)/baud-1;
+    
+    USART_Let_Queue_Empty();
+    /* Wait for the last byte to leave the shift register */
+    while ( !(UCSR0A & (1<<TXC0)) );
+    
+    UBRR0H = (unsigned char)(ubrr>>8);
+    UBRR0L = (unsigned char)ubrr;
+    UCSR0A |= (1<<U2X0);
+    
+    USART_Rx_Flush();
+}
+
+/************************************
+* Function: USART_Rx_Flush
+*
+* Description: Discards every received
+*        byte not read yet, such as
+*        garbage received while the two
+*        ends of the link were at
+*        different baud rates.
+************************************/
+void USART_Rx_Flush(void) {
+    portENTER_CRITICAL();
+    rxTail = rxHead;
+    flowRecordLength = 0;
+    portEXIT_CRITICAL();
+}
+
+/************************************
+* Function: prvTxFree
+*
+* Description: Returns the free space
+*        in the transmit ring buffer.
+************************************/
+static uint8_t prvTxFree(void) {
+	return (txTail - txHead - 1) & TX_BUFFER_MASK;
+}
+
+/************************************
+* Function: USART0_UDRE_vect
+*
+* Description: Sends the next byte of
+*        the transmit ring buffer each
+*        time the data register empties,
+*        and wakes a writer waiting in
+*        USART_WriteBuf once enough
+*        space has been freed.
+************************************/
+ISR(USART0_UDRE_vect) {
+	signed portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+	
+	if (txHead == txTail ||
+	 (flowEnabled && (txHold || (int16_t)(txSent - txAcked) >= (int16_t)txWindow))) {
+		/* Re-enabled by the next write or credit grant */
+		UCSR0B &= ~(1<<UDRIE0);
+	}
+	else {
+		UDR0 = txBuffer[txTail];
+		txTail = (txTail + 1) & TX_BUFFER_MASK;
+		if (flowEnabled)
+			txSent++;
+		/* Clear TXC0 so USART_Set_Baud can tell when this byte is out */
+		UCSR0A = (UCSR0A & (1<<U2X0)) | (1<<TXC0);
+	}
+	
+	if (txNeeded != 0 && prvTxFree() >= txNeeded) {
+		txNeeded = 0;
+		xSemaphoreGiveFromISR(xTxSemaphore, &xHigherPriorityTaskWoken);
+		if (xHigherPriorityTaskWoken != pdFALSE)
+			taskYIELD();
+	}
+}
+
+/************************************
+* Function: prvRxPut
+*
+* Description: Adds a received byte to
+*        the receive ring buffer, or
+*        counts it as lost if the
+*        buffer is full. Only called
+*        from the RX ISR.
+************************************/
+static void prvRxPut(uint8_t data) {
+	uint8_t next = (rxHead + 1) & RX_BUFFER_MASK;
+	
+	if (next != rxTail) {
+		rxBuffer[rxHead] = data;
+		rxHead = next;
+	}
+	else if (rxOverflows != 0xFF) {
+		rxOverflows++;
+	}
+}
+
+/************************************
+* Function: USART0_RX_vect
+*
+* Description: Moves each received byte
+*        into the ring buffer and wakes
+*        a task sleeping in
+*        USART_ReadTimeout. Bytes that
+*        arrive while the buffer is full
+*        are dropped and counted. With
+*        flow control enabled, credit
+*        records are consumed here so
+*        credit arrives even while every
+*        task is blocked writing.
+************************************/
+ISR(USART0_RX_vect) {
+	signed portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+	uint8_t data = UDR0;
+	uint16_t acked;
+	uint8_t i;
+	
+	if (flowEnabled && (flowRecordLength > 0 || data == FLOW_MARKER)) {
+		/* Hold marker records back until it is known if they carry credit */
+		flowRecord[flowRecordLength++] = data;
+		if (flowRecordLength < FLOW_RECORD_SIZE)
+			return;
+		flowRecordLength = 0;
+		
+		if (flowRecord[1] == FLOW_CREDIT) {
+			acked = ((uint16_t)flowRecord[2] << 8) | flowRecord[3];
+			if (txHold) {
+				/* Nothing was sent while held, so both counts start here */
+				txHold = 0;
+				txSent = acked;
+				txAcked = acked;
+			}
+			else if ((int16_t)(acked - txAcked) > 0) {
+				/* Counts older than the last one are ignored */
+				txAcked = acked;
+			}
+			if (txHead != txTail)
+				UCSR0B |= (1<<UDRIE0);
+			return;
+		}
+		
+		for (i = 0; i < FLOW_RECORD_SIZE; i++)
+			prvRxPut(flowRecord[i]);
+	}
+	else {
+		prvRxPut(data);
+	}
+	
+	xSemaphoreGiveFromISR(xRxSemaphore, &xHigherPriorityTaskWoken);
+	if (xHigherPriorityTaskWoken != pdFALSE)
+		taskYIELD();
 }
 
 /************************************
 * Function: USART_Write
 *
 * Description: Adds a byte of data to 
-*			   the back of a queue.
+*			   the transmit ring buffer.
 *
 * Param data: 8bit data value
 ************************************/
 void USART_Write(uint8_t data) {
-	xQueueSendToBack( xUsartQueue, &data, 0);
+	USART_WriteBuf(&data, 1);
+}
+
+/************************************
+* Function: USART_WriteBuf
+*
+* Description: Adds a whole command to
+*        the transmit ring buffer in one
+*        critical section, so commands
+*        from different tasks never
+*        interleave. Sleeps the calling
+*        task while the buffer is too
+*        full, which includes waiting
+*        for flow control credit; with
+*        interrupts disabled the buffer
+*        is drained directly.
+*        Commands longer than the buffer
+*        are added in pieces.
+*
+* Param data: The bytes to send
+* Param len: The number of bytes
+************************************/
+void USART_WriteBuf(const uint8_t *data, uint8_t len) {
+	/* Sampled before any critical section clears the flag */
+	uint8_t polled = !(SREG & (1<<SREG_I));
+	uint8_t chunk;
+	
+	while (len > 0) {
+		chunk = len < TX_BUFFER_MASK ? len : TX_BUFFER_MASK;
+		
+		portENTER_CRITICAL();
+		while (prvTxFree() < chunk) {
+			if (polled) {
+				/* Nothing will drain the buffer for us */
+				while ( !( UCSR0A & (1<<UDRE0)) );
+				UDR0 = txBuffer[txTail];
+				txTail = (txTail + 1) & TX_BUFFER_MASK;
+				continue;
+			}
+			txNeeded = chunk;
+			if (txStalls != 0xFF)
+				txStalls++;
+			portEXIT_CRITICAL();
+			xSemaphoreTake(xTxSemaphore, portMAX_DELAY);
+			portENTER_CRITICAL();
+		}
+		
+		len -= chunk;
+		while (chunk-- > 0) {
+			txBuffer[txHead] = *data++;
+			txHead = (txHead + 1) & TX_BUFFER_MASK;
+		}
+		UCSR0B |= (1<<UDRIE0);
+		portEXIT_CRITICAL();
+	}
+}
+
+/************************************
+* Function: USART_Flow_Enable
+*
+* Description: Turns on credit based
+*        flow control. From now on
+*        at most window bytes are sent
+*        beyond the count the receiver
+*        last acknowledged in a credit
+*        record, so a slow receiver
+*        makes writers block instead of
+*        losing data. Both ends start
+*        counting from zero with the
+*        next byte written; bytes still
+*        queued are sent uncounted.
+*
+* Param window: The bytes the receiver
+*        can buffer
+************************************/
+void USART_Flow_Enable(uint16_t window) {
+	portENTER_CRITICAL();
+	txSent = -(uint16_t)((txHead - txTail) & TX_BUFFER_MASK);
+	txAcked = 0;
+	txWindow = window;
+	flowRecordLength = 0;
+	txHold = 0;
+	flowEnabled = 1;
+	portEXIT_CRITICAL();
+}
+
+/************************************
+* Function: USART_Flow_Resync
+*
+* Description: Holds back everything
+*        written from now on until the
+*        receiver's next credit record,
+*        then resumes flow control from
+*        the count that record carries.
+*        Use it when the receiver has
+*        restarted its count at a time
+*        the sender can not know, such
+*        as when it gives up on a baud
+*        rate on its own. Writers do not
+*        wait unless the transmit ring
+*        buffer fills up meanwhile.
+*        Flow control must be enabled.
+************************************/
+void USART_Flow_Resync(void) {
+	portENTER_CRITICAL();
+	flowRecordLength = 0;
+	txHold = 1;
+	portEXIT_CRITICAL();
+}
+
+/************************************
+* Function: USART_Tx_Stalls
+*
+* Description: Returns how many times a
+*        writer found the transmit ring
+*        buffer full and had to wait,
+*        saturating at 255. A growing
+*        count means the link or the
+*        receiver's credit is the
+*        bottleneck.
+*
+* Return: The number of stalled writes
+************************************/
+uint8_t USART_Tx_Stalls(void) {
+	return txStalls;
 }
 
 /************************************
 * Function: USART_Write_Unprotected
 *
 * Description:Transmits a byte of data 
-*			  via UART
+*			  via UART, bypassing the
+*			  transmit ring buffer
 *
 * Param data: 8bit data value
 ************************************/
@@ -77,58 +414,112 @@ void USART_Write_Unprotected(uint8_t data) {
 *        Note that this a blocking call
 *        Therefore you may not get control 
 *        back after this is called until a 
-*        much later time. It may be helpful 
-*        to use the istheredata() function 
+*        much later time. The calling task
+*        sleeps while it waits. It may be
+*        helpful to use USART_Available
 *        to check before calling this function.
 *
-* Return UDR0: Received data
+* Return: Received data
 ************************************/
 uint8_t USART_Read(void) {
-    /* Wait for data to be received */
-    while ( !(UCSR0A & (1<<RXC0)) );
-    /* Get and return received data from buffer */
-    return UDR0;
+    uint8_t data;
+    
+    while (USART_ReadTimeout(&data, portMAX_DELAY) != pdTRUE);
+    return data;
 }
 
-
 /************************************
-* Function: USART_Queue_Reset
+* Function: USART_ReadTimeout
 *
-* Description: Resets Queue to be empty
+* Description: Takes the next received
+*        byte from the ring buffer,
+*        sleeping the calling task until
+*        one arrives or the timeout
+*        passes. With interrupts
+*        disabled (before the scheduler
+*        starts) the USART is polled
+*        directly instead.
 *
-* Param vParam: This parameter is not used.
+* Param data: Set to the received byte
+* Param ticksToWait: The longest time
+*        to wait for a byte
+* Return: pdTRUE if a byte was read,
+*        pdFALSE on timeout
 ************************************/
-void USART_Queue_Reset(void){
-   xQueueReset(xUsartQueue);
+portBASE_TYPE USART_ReadTimeout(uint8_t *data, portTickType ticksToWait) {
+    portTickType start = xTaskGetTickCount();
+    portTickType waited;
+    
+    while (rxHead == rxTail) {
+        if (!(SREG & (1<<SREG_I))) {
+            /* The RX ISR can not run, so wait on the hardware */
+            while ( !(UCSR0A & (1<<RXC0)) );
+            *data = UDR0;
+            return pdTRUE;
+        }
+        
+        /* The semaphore may still hold a give for a byte already taken,
+         * so wait again until the timeout really passes */
+        waited = xTaskGetTickCount() - start;
+        if (ticksToWait != portMAX_DELAY && waited >= ticksToWait)
+            return pdFALSE;
+        xSemaphoreTake(xRxSemaphore,
+         ticksToWait == portMAX_DELAY ? portMAX_DELAY : ticksToWait - waited);
+    }
+    
+    *data = rxBuffer[rxTail];
+    rxTail = (rxTail + 1) & RX_BUFFER_MASK;
+    return pdTRUE;
 }
 
-
-
 /************************************
-* Function: USART_Let_Queue_Empty
+* Function: USART_Available
 *
-* Description: Waits for queue to empty
+* Description: Checks whether a received
+*        byte is waiting to be read, so
+*        USART_Read can be called
+*        without blocking.
 *
-* Param vParam: This parameter is not used.
+* Return: Nonzero if data is available
 ************************************/
-void USART_Let_Queue_Empty(void){
-   void* pvBuffer; 
-   while (xQueuePeek(xUsartQueue, pvBuffer, 0) == pdTRUE){};  
+uint8_t USART_Available(void) {
+    return rxHead != rxTail || (UCSR0A & (1<<RXC0));
 }
 
-
 /************************************
-* Function: USART_Write_Task
+* Function: USART_Rx_Overflows
 *
-* Description: Sends queued data over UART
+* Description: Returns how many received
+*        bytes were dropped because the
+*        ring buffer was full, saturating
+*        at 255.
 *
-* Param vParam: This parameter is not used.
+* Return: The number of dropped bytes
 ************************************/
-void USART_Write_Task(void *vParam) {
-	uint8_t uart_data;
+uint8_t USART_Rx_Overflows(void) {
+    return rxOverflows;
+}
 
-    while (1) {
-		xQueueReceive( xUsartQueue, &uart_data, portMAX_DELAY);
-		USART_Write_Unprotected(uart_data);
-	}	
-}
\ No newline at end of file
+/************************************
+* Function: USART_Queue_Reset
+*
+* Description: Discards everything
+*        still waiting in the transmit
+*        ring buffer
+************************************/
+void USART_Queue_Reset(void){
+   portENTER_CRITICAL();
+   txTail = txHead;
+   portEXIT_CRITICAL();
+}
+
+/************************************
+* Function: USART_Let_Queue_Empty
+*
+* Description: Waits for the transmit
+*        ring buffer to empty
+************************************/
+void USART_Let_Queue_Empty(void){
+   while (txHead != txTail)
+      vTaskDelay(1);
+}
@@ -8,20 +8,42 @@
 *
 * Revisions:
 * 5/10/12 HAV Added USART_Write_Task
+* Added USART_ReadTimeout
+* Replaced USART_Write_Task with USART_WriteBuf
+* Added flow control
+* Added USART_Set_Baud
+* Added USART_Flow_Resync
 *
 ***************************/
 #ifndef USART_H_
 #define USART_H_
 
-#define QUEUE_SIZE 300
+/* Must be powers of two no larger than 256 */
+#define RX_BUFFER_SIZE 64
+#define TX_BUFFER_SIZE 256
+
+/* Flow control credit record sent by the receiver: FLOW_MARKER, FLOW_CREDIT,
+ * then the number of bytes received since flow control was enabled, modulo
+ * 65536, high byte first. Other records starting with FLOW_MARKER are passed on
+ * unchanged. */
+#define FLOW_MARKER 0xFE
+#define FLOW_CREDIT 0x20
 
 uint8_t USART_Read(void);
+portBASE_TYPE USART_ReadTimeout(uint8_t *data, portTickType ticksToWait);
+uint8_t USART_Available(void);
+uint8_t USART_Rx_Overflows(void);
+void USART_Flow_Enable(uint16_t window);
+void USART_Flow_Resync(void);
+uint8_t USART_Tx_Stalls(void);
 void USART_Write(uint8_t data);
+void USART_WriteBuf(const uint8_t *data, uint8_t len);
 void USART_Write_Unprotected(uint8_t data);
-void USART_Init(uint16_t baudin, uint32_t clk_speedin);
+void USART_Init(uint32_t baudin, uint32_t clk_speedin);
+void USART_Set_Baud(uint32_t baud, uint32_t clk_speed);
+void USART_Rx_Flush(void);
 void USART_Queue_Reset(void);
 void USART_Let_Queue_Empty(void);
-void USART_Write_Task(void *vParam);
 
 
 #endif /* USART_H_ */
@@ -0,0 +1,170 @@
+#include "viewport.h"
+
+/* Window size and culling margin in window pixels */
+static uint16_t windowWidth, windowHeight, viewMargin;
+
+/* Visible world rectangle, margin included */
+static int32_t viewLeft, viewTop, viewRight, viewBottom;
+
+/* Entities added with vViewEntityAdd */
+static xViewEntity *entities = NULL;
+
+/*******************************************************************************
+* Function: prvEntityVisible
+*
+* Description: Tests whether any part of an entity lies within the view.
+*
+* param entity: The entity to test
+* return: Nonzero if the entity may be visible
+*******************************************************************************/
+static uint8_t prvEntityVisible(const xViewEntity *entity) {
+	return (int32_t)entity->x + entity->halfWidth >= viewLeft &&
+	 (int32_t)entity->x - entity->halfWidth <= viewRight &&
+	 (int32_t)entity->y + entity->halfHeight >= viewTop &&
+	 (int32_t)entity->y - entity->halfHeight <= viewBottom;
+}
+
+/*******************************************************************************
+* Function: prvEntityUpdate
+*
+* Description: Sends an entity's latest transform if it is in view. The
+*  transform that takes an entity out of view is still sent, so it is not left
+*  drawn at the edge; after that it is not updated until it comes back.
+*
+* param entity: The entity to update
+*******************************************************************************/
+static void prvEntityUpdate(xViewEntity *entity) {
+	if (!prvEntityVisible(entity)) {
+		if (entity->inView)
+			vSpriteSetTransform(entity->sprite, entity->x, entity->y,
+			 entity->angle);
+		entity->inView = 0;
+		return;
+	}
+	
+	vSpriteSetTransform(entity->sprite, entity->x, entity->y, entity->angle);
+	entity->inView = 1;
+}
+
+/*******************************************************************************
+* Function: vViewportInit
+*
+* Description: Sets the window size and culling margin, and places the camera
+*  at the world origin with no zoom. Call it once after vWindowCreate.
+*
+* param width: Width of the window in pixels
+* param height: Height of the window in pixels
+* param margin: Distance in window pixels beyond each edge of the window within
+*  which entities are still updated, so they do not appear late
+*******************************************************************************/
+void vViewportInit(uint16_t width, uint16_t height, uint16_t margin) {
+	windowWidth = width;
+	windowHeight = height;
+	viewMargin = margin;
+	entities = NULL;
+	
+	vViewportSetCamera(0, 0, CAMERA_ZOOM_1X);
+}
+
+/*******************************************************************************
+* Function: vViewportSetCamera
+*
+* Description: Moves the camera (see vCameraSet) and brings every entity that
+*  came into view up to date.
+*
+* param x: World x-coordinate shown at the window's upper-left corner
+* param y: World y-coordinate shown at the window's upper-left corner
+* param zoom: Scale from world to window pixels in 1/256ths
+*******************************************************************************/
+void vViewportSetCamera(uint16_t x, uint16_t y, uint16_t zoom) {
+	xViewEntity *entity;
+	
+	if (zoom == 0)
+		zoom = 1;
+	
+	viewLeft = (int32_t)x - ((int32_t)viewMargin * CAMERA_ZOOM_1X) / zoom;
+	viewTop = (int32_t)y - ((int32_t)viewMargin * CAMERA_ZOOM_1X) / zoom;
+	viewRight = (int32_t)x +
+	 ((int32_t)(windowWidth + viewMargin) * CAMERA_ZOOM_1X) / zoom;
+	viewBottom = (int32_t)y +
+	 ((int32_t)(windowHeight + viewMargin) * CAMERA_ZOOM_1X) / zoom;
+	
+	vCameraSet(x, y, zoom);
+	
+	for (entity = entities; entity != NULL; entity = entity->next) {
+		if (!entity->inView)
+			prvEntityUpdate(entity);
+		else if (!prvEntityVisible(entity))
+			entity->inView = 0;
+	}
+}
+
+/*******************************************************************************
+* Function: vViewEntityAdd
+*
+* Description: Starts culling a sprite's transform updates. The sprite must
+*  already have the given transform, as it does right after xSpriteCreate.
+*
+* param entity: Storage for the entity, which must stay valid until it is
+*  passed to vViewEntityRemove
+* param sprite: The handle to the sprite
+* param x: The sprite's current x-position in world coords
+* param y: The sprite's current y-position in world coords
+* param angle: The sprite's current angle
+* param width: The sprite's width in pixels, the largest it gets when rotated
+* param height: The sprite's height in pixels, the largest it gets when rotated
+*******************************************************************************/
+void vViewEntityAdd(xViewEntity *entity, xSpriteHandle sprite, uint16_t x,
+ uint16_t y, uint16_t angle, uint16_t width, uint16_t height) {
+	entity->sprite = sprite;
+	entity->x = x;
+	entity->y = y;
+	entity->angle = angle;
+	entity->halfWidth = width >> 1;
+	entity->halfHeight = height >> 1;
+	entity->inView = prvEntityVisible(entity);
+	
+	entity->next = entities;
+	entities = entity;
+}
+
+/*******************************************************************************
+* Function: vViewEntityRemove
+*
+* Description: Stops culling an entity, typically just before its sprite is
+*  deleted. The sprite is not changed.
+*
+* param entity: The entity to remove
+*******************************************************************************/
+void vViewEntityRemove(xViewEntity *entity) {
+	xViewEntity **link = &entities;
+	
+	while (*link != NULL) {
+		if (*link == entity) {
+			*link = entity->next;
+			return;
+		}
+		link = &(*link)->next;
+	}
+}
+
+/*******************************************************************************
+* Function: vViewEntitySetTransform
+*
+* Description: Records an entity's new position and angle, and sends them to
+*  the graphics context only if the entity is in view. Use in place of
+*  vSpriteSetTransform for sprites added to the viewport.
+*
+* param entity: The entity to move
+* param x: New x-position of the sprite's center in world coords
+* param y: New y-position of the sprite's center in world coords
+* param angle: Angle in degrees to rotate the sprite CCW about its center
+*******************************************************************************/
+void vViewEntitySetTransform(xViewEntity *entity, uint16_t x, uint16_t y,
+ uint16_t angle) {
+	entity->x = x;
+	entity->y = y;
+	entity->angle = angle;
+	
+	prvEntityUpdate(entity);
+}
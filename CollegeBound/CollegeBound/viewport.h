@@ -0,0 +1,36 @@
+/*******************************************************************************
+* File: viewport.h
+*
+* Description: Culling layer above the graphics module for worlds larger than
+*  the window. Entities outside the camera's view (plus a margin) send no
+*  transform updates; each is brought up to date when it comes back into view,
+*  so link traffic follows the number of visible entities rather than the size
+*  of the world.
+*******************************************************************************/
+#ifndef VIEWPORT_H_
+#define VIEWPORT_H_
+
+#include "graphics.h"
+
+/* A sprite whose transform updates go through the viewport. The caller owns
+ * the storage; the fields are managed by the viewport functions. */
+typedef struct xViewEntity {
+	xSpriteHandle sprite;
+	uint16_t x, y;               /* latest center position in world coords */
+	uint16_t angle;              /* latest angle */
+	uint16_t halfWidth;          /* half the sprite's extent, for culling */
+	uint16_t halfHeight;
+	uint8_t inView;              /* graphics context has the latest transform */
+	struct xViewEntity *next;
+} xViewEntity;
+
+void vViewportInit(uint16_t width, uint16_t height, uint16_t margin);
+void vViewportSetCamera(uint16_t x, uint16_t y, uint16_t zoom);
+
+void vViewEntityAdd(xViewEntity *entity, xSpriteHandle sprite, uint16_t x,
+ uint16_t y, uint16_t angle, uint16_t width, uint16_t height);
+void vViewEntityRemove(xViewEntity *entity);
+void vViewEntitySetTransform(xViewEntity *entity, uint16_t x, uint16_t y,
+ uint16_t angle);
+
+#endif /* VIEWPORT_H_ */
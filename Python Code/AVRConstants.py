@@ -14,6 +14,22 @@ SET_ROT = 0x03
 SET_ORDER = 0x0C
 SET_SIZE = 0x0D
 DELETE_SPRITE = 0x04
+SET_VELOCITY = 0x26				#pixels per second, integrated by the host every render pass
+SET_ANGULAR_VELOCITY = 0x27		#degrees per second CCW
+SET_VISIBLE = 0x28				#hidden sprites are not drawn and collide with nothing
+SET_FRAME = 0x2A				#frame n of a sprite is the image registered n IDs after its own
+SET_SCREEN_SPACE = 0x2F			#nonzero places the sprite in window coordinates, ignoring the camera
+ATTACH = 0x30					#child, parent, flags, offset; a parent of HANDLE_ERROR detaches
+ATTACH_ROTATE = 0x01			#the offset and the child's angle turn with the parent
+SET_CAMERA = 0x2E				#world x, y at the window's upper-left corner, zoom in 1/256ths
+CAMERA_ZOOM_1X = 0x100
+
+#combined transform; the low nibble of the command holds the XFORM_* flags
+SET_TRANSFORM = 0x10
+XFORM_X = 0x01
+XFORM_Y = 0x02
+XFORM_ANGLE = 0x04
+XFORM_FULL = 0x08
 
 CREATE_GROUP = 0x05
 ADD_TO_GROUP = 0x06
@@ -21,15 +37,87 @@ REMOVE_FROM_GROUP = 0x07
 DELETE_GROUP = 0x08
 
 COLLIDE = 0x09
+COLLIDE_BATCH = 0x21
+SUBSCRIBE_COLLISIONS = 0x22
+UNSUBSCRIBE_COLLISIONS = 0x23
+SET_BAUD = 0x24
+PING = 0x25
 CREATE_WINDOW = 0x0A
 
 PRINT = 0x0B
 
+REGISTER_IMAGE = 0x20
+CREATE_TEXT = 0x2B
+SET_TEXT = 0x2C
+
+#font table for CREATE_TEXT, indexed by the AVR's font number; None is pygame's default font
+FONTS = [None]
+TEXT_COLOR = (255, 255, 255)
+
+LOAD_TILEMAP = 0x2D				#handle, depth, .tmx filename; replies with the map size and solid tiles
+
+REGISTER_SHEET = 0x29			#first ID, frame count, filename; frames are equal widths, left to right
+
+BEGIN_FRAME = 0x0E
+END_FRAME = 0x0F
+
+#field mask bits of a frame record
+FIELD_POS = 0x01
+FIELD_ROT = 0x02
+FIELD_SIZE = 0x04
+FIELD_DEPTH = 0x08
+FIELD_DELTA = 0x10
+FIELD_VELOCITY = 0x20
+FIELD_ANGULAR_VEL = 0x40
+FIELD_VISIBLE = 0x80
+
 INT8 = 0x01
 INT16 = 0x02
 STRING = 0x03
+FRAME = 0x04
+SVARINT = 0x05
+LIST = 0x06		#used as (LIST, [types]): a count followed by that many groups of types
+SINT16 = 0x07
 
 ALL_GROUP = 0x00
 HANDLE_ERROR = 0xFF
 
+#asynchronous status records sent to the AVR: STATUS_MARKER, status, handle, arg
+STATUS_MARKER = 0xFE
+STATUS_CREATE_FAILED = 0x01
+STATUS_REGISTER_FAILED = 0x02
+STATUS_PACKET_DROPPED = 0x03	#a packet failed its CRC
+STATUS_COLLISION_BEGIN = 0x10	#handle and arg are the two sprites, groupA's first
+STATUS_COLLISION_END = 0x11
+STATUS_CREDIT = 0x20			#handle and arg are the bytes received since flow control started, modulo 65536, high byte first
+
+#bytes of packets parsed between credit records; well below the AVR's HOST_RX_WINDOW
+CREDIT_BATCH = 64
+
+#every command from the AVR is sent as PACKET_SYNC, length, payload, CRC-16/CCITT (high byte first)
+#where the CRC covers the length and payload
+PACKET_SYNC = 0xA5
+PACKET_PAYLOAD_MAX = 64		#longest payload the AVR sends; a longer length byte is corrupt
+
 BAUD_RATE = 38400
+
+#after accepting SET_BAUD, the link goes back to BAUD_RATE unless a PING arrives within this many seconds
+BAUD_PROBE_TIMEOUT = 1.5
+#fastest rate accepted from SET_BAUD unless another is given on the command line
+MAX_BAUD_RATE = 1000000
+
+#a capture log (--record) starts with CAPTURE_MAGIC, then holds one record per packet received:
+#seconds since capture started (little-endian double), payload length (byte), payload
+CAPTURE_MAGIC = 'AVRCAP1\n'
+CAPTURE_RECORD = '<dB'
+
+#scaled and rotated surfaces are shared between sprites through an LRU cache of about this many bytes
+SURFACE_CACHE_BYTES = 32 * 1024 * 1024
+#sprite angles are drawn rounded to a multiple of this many degrees, so nearby angles share a surface
+ANGLE_STEP = 1
+
+#side in window pixels of the grid cells collision queries are narrowed to
+SPATIAL_CELL_SIZE = 64
+
+#longest the serial thread holds commands received outside a frame before publishing them to the render thread
+PUBLISH_INTERVAL = 0.01
@@ -10,50 +10,153 @@
 
 import pygame
 from pygame import event, display
-import sys, os, imp
-from threading import Thread, Semaphore
+import sys, os, imp, binascii, time, struct, getopt
+from threading import Thread, Semaphore, Lock
+from collections import deque
+from Queue import Queue, Empty
+from xml.etree import ElementTree
 from serial import Serial
 
 import AVRConstants as const
-from AVRConstants import INT8, INT16, STRING
+from AVRConstants import INT8, INT16, SINT16, STRING, FRAME, SVARINT, LIST
 from AVRSprite import AVRSprite
+from AVRText import AVRText
+from AVRTilemap import AVRTilemap
 from AVRGroup import AVRGroup
 
 class AVRInterface(object):
 	class exception(Exception):
 		pass
 	
+	#big-endian struct formats for the fixed-size argument types
+	fixedTypes = {INT8: struct.Struct('>B'), INT16: struct.Struct('>H'), SINT16: struct.Struct('>h')}
+	sync = chr(const.PACKET_SYNC)
+	recordHeader = struct.Struct('>BB')		#frame record handle and field mask
+	pair = struct.Struct('>HH')
+	signedPair = struct.Struct('>hh')
+	
+	class nullLink(object):
+		#stands in for the serial port during replay; replies go nowhere
+		baudrate = const.BAUD_RATE
+		def write(self, data):
+			pass
+		def flush(self):
+			pass
+	
 	def __init__(self):
-		if len(sys.argv) < 2:
-			print "usage: AVRInterface <COM_PORT>"
+		try:
+			opts, args = getopt.gnu_getopt(sys.argv[1:], '', ['record=', 'replay=', 'fast', 'debug'])
+		except getopt.GetoptError:
+			args, opts = [], []
+		opts = dict(opts)
+		if not args and '--replay' not in opts:
+			print "usage: AVRInterface <COM_PORT> [MAX_BAUD] [--record LOG] [--debug]"
+			print "       AVRInterface --replay LOG [--fast] [--debug]"
 			return
 	
 		pygame.init()
 		self.displayInit = Semaphore(0)
 		self.windowInit = Semaphore(0)
 		self.running = True					#set to false if window is destroyed; stops sensor polling thread
+		self.frameRecords = []				#sprite updates received since the last END_FRAME
+		self.pendingCamera = None			#camera move received with those updates
+		self.frameOpen = False				#between BEGIN_FRAME and END_FRAME
+		self.backBuffer = []				#(handler, args, reply) the serial thread has not published yet
+		self.published = deque()			#batches handed to the render thread, oldest first
+		self.publishAt = 0					#time by which commands outside a frame are published
+		self.rendering = False				#render loop running; until then commands run on the serial thread
+		self.failedHandles = set()			#sprite handles whose creation failed; commands to them are ignored
+		self.subscriptions = {}				#(groupA, groupB) -> set of (sprite, sprite) pairs in contact
+		self.writeLock = Lock()				#replies and pushed status records come from different threads
+		self.consumed = 0					#bytes parsed since flow control started, modulo 65536
+		self.reported = 0					#consumed as last sent to the AVR in a credit record
+		self.flowActive = False				#the AVR uses flow control once the window is created
+		self.rxBuffer = bytearray()			#bytes read from the link but not yet parsed
+		self.rxStart = 0					#where the search for the next PACKET_SYNC resumes
+		self.counted = 0					#rxBuffer bytes before this index are included in consumed
+		self.payload = bytearray()			#the packet currently being parsed
+		self.offset = 0						#read position within it
+		self.debug = '--debug' in opts		#trace every command received
+		self.baudDeadline = None			#time to give up on a new baud rate if no PING arrives
+		self.capture = None					#log every received packet is appended to (--record)
+		self.replay = None					#log packets are read from instead of the board (--replay)
+		self.replayFast = '--fast' in opts	#replay as fast as the host can parse, ignoring timestamps
+		self.renderPasses = 0				#counted for the replay report
+		self.replayed = 0
 		
-		self.sensor = Serial(port=sys.argv[1], baudrate=const.BAUD_RATE, timeout=1)
-		self.sensor.write(chr(0xff))
-		print "Sent initialization 0xff"
+		if '--replay' in opts:
+			self.replay = open(opts['--replay'], 'rb')
+			if self.replay.read(len(const.CAPTURE_MAGIC)) != const.CAPTURE_MAGIC:
+				print "ERROR: '%s' is not a capture log" % opts['--replay']
+				return
+			self.maxBaud = const.MAX_BAUD_RATE
+			self.sensor = AVRInterface.nullLink()
+		else:
+			self.maxBaud = int(args[1]) if len(args) > 1 else const.MAX_BAUD_RATE
+			#a short timeout lets fill notice when a baud rate switch has failed
+			self.sensor = Serial(port=args[0], baudrate=const.BAUD_RATE, timeout=0.1)
+			self.sensor.write(chr(0xff))
+			print "Sent initialization 0xff"
+			if '--record' in opts:
+				#unbuffered, so the log is complete however the session ends
+				self.capture = open(opts['--record'], 'wb', 0)
+				self.capture.write(const.CAPTURE_MAGIC)
+		self.clockStart = time.time()		#capture timestamps count from here
 		
 		#function command to the python handle function and the argument types it takes
 		self.mapping = {
-			const.CREATE_SPRITE: [self.onCreateSprite, [STRING, INT16, INT16, INT16, INT16, INT16, INT8]],
+			const.REGISTER_IMAGE: [self.onRegisterImage, [INT8, STRING]],
+			const.REGISTER_SHEET: [self.onRegisterSheet, [INT8, INT8, STRING]],
+			const.CREATE_SPRITE: [self.onCreateSprite, [INT8, INT8, INT16, INT16, INT16, INT16, INT16, INT8]],
 			const.SET_POS: [self.onSetPos, [INT8, INT16, INT16]],
 			const.SET_ROT: [self.onSetRot, [INT8, INT16]],
 			const.SET_ORDER: [self.onSetOrder, [INT8, INT8]],
 			const.SET_SIZE: [self.onSetSize, [INT8, INT16, INT16]],
+			const.SET_VELOCITY: [self.onSetVelocity, [INT8, SINT16, SINT16]],
+			const.SET_ANGULAR_VELOCITY: [self.onSetAngularVelocity, [INT8, SINT16]],
+			const.SET_VISIBLE: [self.onSetVisible, [INT8, INT8]],
+			const.SET_FRAME: [self.onSetFrame, [INT8, INT8]],
+			const.SET_SCREEN_SPACE: [self.onSetScreenSpace, [INT8, INT8]],
+			const.ATTACH: [self.onAttach, [INT8, INT8, INT8, SINT16, SINT16]],
+			const.SET_CAMERA: [self.onSetCamera, [INT16, INT16, INT16]],
+			const.LOAD_TILEMAP: [self.onLoadTilemap, [INT8, INT8, STRING]],
+			const.CREATE_TEXT: [self.onCreateText, [INT8, INT8, INT8, INT16, INT16, INT8]],
+			const.SET_TEXT: [self.onSetText, [INT8, STRING]],
 			const.DELETE_SPRITE: [self.onDeleteSprite, [INT8]],
 			const.CREATE_GROUP: [self.onCreateGroup, []],
 			const.ADD_TO_GROUP: [self.onAddToGroup, [INT8, INT8]],
 			const.REMOVE_FROM_GROUP: [self.onRemoveFromGroup, [INT8, INT8]],
 			const.DELETE_GROUP: [self.onDeleteGroup, [INT8]],
 			const.COLLIDE: [self.onCollide, [INT8, INT8]],
+			const.COLLIDE_BATCH: [self.onCollideBatch, [(LIST, [INT8, INT8])]],
+			const.SUBSCRIBE_COLLISIONS: [self.onSubscribe, [INT8, INT8]],
+			const.UNSUBSCRIBE_COLLISIONS: [self.onUnsubscribe, [INT8, INT8]],
+			const.SET_BAUD: [self.onSetBaud, [INT16]],
+			const.PING: [self.onPing, []],
 			const.CREATE_WINDOW: [self.onCreateWindow, [INT16, INT16]],
 			const.PRINT: [self.onPrint, [STRING]],
+			const.BEGIN_FRAME: [self.onBeginFrame, [FRAME]],
+			const.END_FRAME: [self.onEndFrame, []],
+			const.SET_TRANSFORM | const.XFORM_FULL: [self.onSetTransform, [INT8, INT16, INT16, INT16]],
 		}
 		
+		#one delta command per combination of flags; each present value is a signed varint
+		for flags in range(const.XFORM_FULL):
+			deltas = [SVARINT for bit in (const.XFORM_X, const.XFORM_Y, const.XFORM_ANGLE) if flags & bit]
+			self.mapping[const.SET_TRANSFORM | flags] = [self.makeTransformDelta(flags), [INT8] + deltas]
+		
+		#commands that only concern the link run on the serial thread; the AVR waits for the
+		#reply to a query, which runs on the render thread. Everything else is published
+		self.linkCommands = set([const.REGISTER_IMAGE, const.REGISTER_SHEET, const.SET_BAUD, const.PING,
+			const.CREATE_WINDOW, const.PRINT, const.BEGIN_FRAME, const.END_FRAME, const.SET_CAMERA])
+		self.queryCommands = set([const.COLLIDE, const.COLLIDE_BATCH, const.CREATE_GROUP, const.LOAD_TILEMAP])
+		
+		#commands whose arguments are all fixed-size are unpacked with one precompiled struct
+		self.formats = {}
+		for command, (handler, types) in self.mapping.items():
+			if all(not isinstance(t, tuple) and t in AVRInterface.fixedTypes for t in types):
+				self.formats[command] = struct.Struct('>' + ''.join(AVRInterface.fixedTypes[t].format[1:] for t in types))
+		
 		self.run()
 	
 	def run(self):		
@@ -66,6 +169,7 @@ class AVRInterface(object):
 		self.back = pygame.Surface((self.width,self.height))
 		self.back.fill((0,0,0), pygame.Rect(0,0,self.width, self.height))
 		
+		self.rendering = True
 		self.displayInit.release()
 		
 		self.pygameMainloop()
@@ -73,38 +177,185 @@ class AVRInterface(object):
 	def pygameMainloop(self):
 		print "Starting Render Loop"
 		
+		lastMove = time.time()
 		while self.running:
 			for e in event.get():
 				if e.type == pygame.QUIT: 
 					self.running = False
 					sys.exit()
 					
-			#clear then delete things atomically
-			AVRSprite.deleteLock.acquire()
+			#only whole published batches are applied, so half of a frame is never drawn
+			self.applyPublished()
+			
 			AVRSprite.spriteDrawGroup.clear(self.disp, self.back)
 			AVRSprite.onDelete()
-			AVRSprite.deleteLock.release()
 			
+			now = time.time()
+			AVRSprite.move(now - lastMove)
+			AVRSprite.compose()
+			lastMove = now
 			AVRSprite.updateGraphics()
-			
-			AVRSprite.spriteLock.acquire()
 			display.update(AVRSprite.spriteDrawGroup.draw(self.disp))
-			AVRSprite.spriteLock.release()
 			
-			AVRSprite.update()
+			self.pushCollisions()
+			self.renderPasses += 1
+			#answer queries that arrived while drawing without waiting a whole pass
+			self.applyPublished()
+	
+	def post(self, handler, args):
+		#queue a command for the render thread; it is applied when next published
+		if not self.rendering:
+			handler(*args)
+			return
+		self.backBuffer.append((handler, args, None))
+	
+	def publish(self):
+		#hand the back buffer to the render thread in one step; deque appends need no lock
+		if self.backBuffer:
+			self.published.append(self.backBuffer)
+			self.backBuffer = []
+		self.publishAt = time.time() + const.PUBLISH_INTERVAL
+	
+	def ask(self, handler, args):
+		#run a query on the render thread after everything received before it, and wait for the answer
+		if not self.rendering:
+			return handler(*args)
+		reply = Queue(1)
+		self.backBuffer.append((handler, args, reply))
+		self.publish()
+		while self.running:
+			try:
+				result = reply.get(timeout=0.1)
+			except Empty:
+				continue
+			if isinstance(result, AVRInterface.exception):
+				raise result
+			return result
+		raise AVRInterface.exception('render loop stopped')
 	
-	def onCreateSprite(self, file, x, y, angle, w, h, order):
+	def applyPublished(self):
+		#render thread; batches are applied whole and in the order they were published
+		while self.published:
+			for handler, args, reply in self.published.popleft():
+				try:
+					result = handler(*args)
+				except AVRInterface.exception as e:
+					print "Exception:", e
+					result = e
+				if reply is not None:
+					reply.put(result)
+	
+	def pushCollisions(self):
+		#test each subscribed pair of groups and send only the contacts that changed
+		for key in self.subscriptions.keys():
+			groupA, groupB = key
+			if groupA not in AVRGroup.groupList or groupB not in AVRGroup.groupList:
+				#a deleted group ends the subscription
+				self.subscriptions.pop(key, None)
+				continue
+			
+			contacts = set()
+			for s in AVRGroup.groupList[groupA].sprites[:]:
+				if s.sprite is None:
+					continue
+				for other in s.collide(AVRGroup.groupList[groupB]):
+					contacts.add((s.handle, other))
+			
+			previous = self.subscriptions[key]
+			for a, b in contacts - previous:
+				self.sendStatus(const.STATUS_COLLISION_BEGIN, a, b)
+			for a, b in previous - contacts:
+				#the AVR already knows about contacts that ended by deleting a sprite
+				if a in AVRSprite.spriteList and b in AVRSprite.spriteList:
+					self.sendStatus(const.STATUS_COLLISION_END, a, b)
+			self.subscriptions[key] = contacts
+	
+	def onRegisterImage(self, image, file):
 		try:
-			s = AVRSprite(file, (x,y), angle, (w,h), order)
+			AVRSprite.registerImage(image, file)
 		except pygame.error:
-			return const.HANDLE_ERROR
-		if s.handle == -1:
-			return const.HANDLE_ERROR
-		return s.handle		
+			self.sendStatus(const.STATUS_REGISTER_FAILED, image)
+		return -1
+	
+	def onRegisterSheet(self, image, frames, file):
+		try:
+			AVRSprite.registerSheet(image, frames, file)
+		except pygame.error:
+			self.sendStatus(const.STATUS_REGISTER_FAILED, image)
+		return -1
+	
+	def onCreateSprite(self, handle, image, x, y, angle, w, h, order):
+		#the AVR chose the handle and is not waiting, so failures are reported asynchronously
+		self.failedHandles.discard(handle)
+		if handle in AVRSprite.spriteList:
+			print "createSprite: Handle %d already in use" % handle
+			self.onCreateFailed(handle)
+			return -1
+		if image not in AVRSprite.imageList:
+			print "createSprite: Unknown image %d" % image
+			self.onCreateFailed(handle)
+			return -1
+		AVRSprite(handle, image, (x,y), angle, (w,h), order)
+		return -1
+	
+	def onCreateText(self, handle, font, size, x, y, order):
+		self.failedHandles.discard(handle)
+		if handle in AVRSprite.spriteList:
+			print "createText: Handle %d already in use" % handle
+			self.onCreateFailed(handle)
+			return -1
+		AVRText(handle, font, size, (x,y), order)
+		return -1
+	
+	def onSetText(self, handle, text):
+		if handle in AVRSprite.spriteList and isinstance(AVRSprite.spriteList[handle], AVRText):
+			AVRSprite.spriteList[handle].setText(text)
+		elif handle in self.failedHandles:
+			pass
+		else:
+			print "setText: Unknown text handle %d" % handle
+			raise AVRInterface.exception('onSetText')
+		return -1
+	
+	def onLoadTilemap(self, handle, order, file):
+		#replies width, height, tile width, tile height, then the solid tiles; a width of 0 is a failure
+		self.failedHandles.discard(handle)
+		try:
+			if handle in AVRSprite.spriteList:
+				raise ValueError("handle %d already in use" % handle)
+			tilemap = AVRTilemap(handle, file, order)
+			if max(tilemap.width, tilemap.height, tilemap.tileWidth, tilemap.tileHeight) >= const.STATUS_MARKER:
+				tilemap.delete()
+				raise ValueError("map is too large")
+		except (IOError, ValueError, KeyError, AttributeError, pygame.error, ElementTree.ParseError) as e:
+			print "ERROR: Could not load tilemap '%s': %s" % (file, e)
+			#the AVR deletes the handle itself
+			self.failedHandles.add(handle)
+			return 0
+		reply = [tilemap.width, tilemap.height, tilemap.tileWidth, tilemap.tileHeight] + tilemap.solidBits()
+		self.send(''.join(chr(b) for b in reply))
+		return -1
+	
+	def onCreateFailed(self, handle):
+		self.failedHandles.add(handle)
+		self.sendStatus(const.STATUS_CREATE_FAILED, handle)
+	
+	def sendStatus(self, status, handle, arg=0x00):
+		self.send(chr(const.STATUS_MARKER) + chr(status) + chr(handle & 0xff) + chr(arg & 0xff))
+	
+	def send(self, data):
+		#status records must never land in the middle of a reply
+		self.writeLock.acquire()
+		try:
+			self.sensor.write(data)
+		finally:
+			self.writeLock.release()
 	
 	def onSetPos(self, handle, x, y):
 		if handle in AVRSprite.spriteList:
 			AVRSprite.spriteList[handle].setPos((x,y))
+		elif handle in self.failedHandles:
+			pass
 		else:
 			print "setPos: Unknown handle %d" % handle
 			raise AVRInterface.exception('onSetPos')
@@ -113,14 +364,124 @@ class AVRInterface(object):
 	def onSetRot(self, handle, angle):
 		if handle in AVRSprite.spriteList:
 			AVRSprite.spriteList[handle].setAngle(angle)
+		elif handle in self.failedHandles:
+			pass
 		else:
 			print "setAngle: Unknown handle %d" % handle
 			raise AVRInterface.exception('onSetRot')
 		return -1
 	
+	def onSetTransform(self, handle, x, y, angle):
+		if handle in AVRSprite.spriteList:
+			s = AVRSprite.spriteList[handle]
+			s.setPos((x,y))
+			s.setAngle(angle)
+		elif handle in self.failedHandles:
+			pass
+		else:
+			print "setTransform: Unknown handle %d" % handle
+			raise AVRInterface.exception('onSetTransform')
+		return -1
+	
+	def makeTransformDelta(self, flags):
+		#returns the handler for a SET_TRANSFORM carrying the deltas named in flags
+		def onTransformDelta(handle, *deltas):
+			if handle in self.failedHandles:
+				return -1
+			if handle not in AVRSprite.spriteList:
+				print "transformDelta: Unknown handle %d" % handle
+				raise AVRInterface.exception('onTransformDelta')
+			s = AVRSprite.spriteList[handle]
+			deltas = list(deltas)
+			dx = deltas.pop(0) if flags & const.XFORM_X else 0
+			dy = deltas.pop(0) if flags & const.XFORM_Y else 0
+			dAngle = deltas.pop(0) if flags & const.XFORM_ANGLE else 0
+			s.setPos(((s.sentPos[0] + dx) & 0xFFFF, (s.sentPos[1] + dy) & 0xFFFF))
+			s.setAngle((s.sentAngle + dAngle) & 0xFFFF)
+			return -1
+		return onTransformDelta
+	
+	def onSetVelocity(self, handle, vx, vy):
+		if handle in AVRSprite.spriteList:
+			AVRSprite.spriteList[handle].setVelocity((vx,vy))
+		elif handle in self.failedHandles:
+			pass
+		else:
+			print "setVelocity: Unknown handle %d" % handle
+			raise AVRInterface.exception('onSetVelocity')
+		return -1
+	
+	def onSetAngularVelocity(self, handle, rate):
+		if handle in AVRSprite.spriteList:
+			AVRSprite.spriteList[handle].setAngularVelocity(rate)
+		elif handle in self.failedHandles:
+			pass
+		else:
+			print "setAngularVelocity: Unknown handle %d" % handle
+			raise AVRInterface.exception('onSetAngularVelocity')
+		return -1
+	
+	def onSetVisible(self, handle, visible):
+		if handle in AVRSprite.spriteList:
+			AVRSprite.spriteList[handle].setVisible(visible)
+		elif handle in self.failedHandles:
+			pass
+		else:
+			print "setVisible: Unknown handle %d" % handle
+			raise AVRInterface.exception('onSetVisible')
+		return -1
+	
+	def onSetFrame(self, handle, frame):
+		if handle in AVRSprite.spriteList:
+			if not AVRSprite.spriteList[handle].setFrame(frame):
+				print "setFrame: Sprite %d has no frame %d" % (handle, frame)
+		elif handle in self.failedHandles:
+			pass
+		else:
+			print "setFrame: Unknown handle %d" % handle
+			raise AVRInterface.exception('onSetFrame')
+		return -1
+	
+	def onSetScreenSpace(self, handle, screen):
+		if handle in AVRSprite.spriteList:
+			AVRSprite.spriteList[handle].setScreenSpace(screen)
+		elif handle in self.failedHandles:
+			pass
+		else:
+			print "setScreenSpace: Unknown handle %d" % handle
+			raise AVRInterface.exception('onSetScreenSpace')
+		return -1
+	
+	def onAttach(self, handle, parent, flags, dx, dy):
+		if handle in AVRSprite.spriteList:
+			if parent in AVRSprite.spriteList:
+				AVRSprite.spriteList[handle].attach(AVRSprite.spriteList[parent], (dx, dy), flags)
+			elif parent == const.HANDLE_ERROR or parent in self.failedHandles:
+				AVRSprite.spriteList[handle].detach()
+			else:
+				print "attach: Unknown parent handle %d" % parent
+				raise AVRInterface.exception('onAttach')
+		elif handle in self.failedHandles:
+			pass
+		else:
+			print "attach: Unknown handle %d" % handle
+			raise AVRInterface.exception('onAttach')
+		return -1
+	
+	def onSetCamera(self, x, y, zoom):
+		camera = (x, y, max(zoom, 1) / float(const.CAMERA_ZOOM_1X))
+		if self.frameOpen:
+			#the AVR moved the camera inside a frame; apply both together at END_FRAME
+			self.pendingCamera = camera
+			return -1
+		self.post(AVRSprite.setCamera, camera)
+		return -1
+	
 	def onSetSize(self, handle, x, y):
 		if handle in AVRSprite.spriteList:
 			AVRSprite.spriteList[handle].setSize((x,y))
+		elif handle in self.failedHandles:
+			pass
 		else:
 			print "setSize: Unknown handle %d" % handle
 			raise AVRInterface.exception('onSetSize')
@@ -129,6 +490,8 @@ class AVRInterface(object):
 	def onSetOrder(self, handle, order):
 		if handle in AVRSprite.spriteList:
 			AVRSprite.spriteList[handle].setOrder(order)
+		elif handle in self.failedHandles:
+			pass
 		else:
 			print "setOrder: Unknown handle %d" % handle
 			raise AVRInterface.exception('onSetOrder')
@@ -137,6 +500,8 @@ class AVRInterface(object):
 	def onDeleteSprite(self, handle):
 		if handle in AVRSprite.spriteList:
 			AVRSprite.spriteList[handle].delete()
+		elif handle in self.failedHandles:
+			self.failedHandles.remove(handle)
 		else:
 			print "deleteSprite: Unknown handle %d" % handle
 			raise AVRInterface.exception('deleteSprite')
@@ -152,6 +517,8 @@ class AVRInterface(object):
 		if groupHandle not in AVRGroup.groupList:
 			print "addToGroup: Unknown group handle %d" % groupHandle
 			raise AVRInterface.exception('onAddToGroup')
+		elif spriteHandle in self.failedHandles:
+			pass
 		elif spriteHandle not in AVRSprite.spriteList:
 			print "addToGroup: Unknown sprite handle %d" % spriteHandle
 			raise AVRInterface.exception('onAddToGroup')
@@ -163,6 +530,8 @@ class AVRInterface(object):
 		if groupHandle not in AVRGroup.groupList:
 			print "removeFromGroup: Unknown group handle %d" % groupHandle
 			raise AVRInterface.exception('onRemoveFromGroup')
+		elif spriteHandle in self.failedHandles:
+			pass
 		elif spriteHandle not in AVRSprite.spriteList:
 			print "removeFromGroup: Unknown sprite handle %d" % spriteHandle
 			raise AVRInterface.exception('onRemoveFromGroup')
@@ -181,81 +550,363 @@ class AVRInterface(object):
 		if groupHandle not in AVRGroup.groupList:
 			print "collide: Unknown group handle %d" % groupHandle
 			raise AVRInterface.exception('onCollide')
+		elif spriteHandle in self.failedHandles:
+			return []
 		elif spriteHandle not in AVRSprite.spriteList:
 			print "collide: Unknown sprite handle %d" % spriteHandle
 			raise AVRInterface.exception('onCollide')
 		else:
 			return AVRSprite.spriteList[spriteHandle].collide(AVRGroup.groupList[groupHandle])
 		return []
+	
+	def onCollideBatch(self, queries):
+		#one hit list per (sprite, group) query, in order; the AVR reads exactly one per query,
+		#so a query naming an unknown sprite or group is answered with an empty list
+		results = []
+		for spriteHandle, groupHandle in queries:
+			try:
+				results.append(self.onCollide(spriteHandle, groupHandle))
+			except AVRInterface.exception:
+				results.append([])
+		return tuple(results)
+	
+	def onSubscribe(self, groupA, groupB):
+		for groupHandle in (groupA, groupB):
+			if groupHandle not in AVRGroup.groupList:
+				print "subscribe: Unknown group handle %d" % groupHandle
+				raise AVRInterface.exception('onSubscribe')
+		self.subscriptions.setdefault((groupA, groupB), set())
+		return -1
+	
+	def onUnsubscribe(self, groupA, groupB):
+		self.subscriptions.pop((groupA, groupB), None)
+		return -1
 		
 	def onCreateWindow(self, w, h):
 		self.width, self.height = w, h
 		self.windowInit.release()
 		self.displayInit.acquire()
 		
+		#the AVR turns on flow control after this command and counts the bytes that follow it
+		self.resetCredit()
+		self.flowActive = True
 		return -1
 	
+	def onSetBaud(self, kbaud):
+		baud = kbaud * 1000
+		if baud > self.maxBaud:
+			return 0
+		
+		#the acceptance has to go out at the old rate before switching
+		self.send(chr(1))
+		self.sensor.flush()
+		self.sensor.baudrate = baud
+		self.baudDeadline = time.time() + const.BAUD_PROBE_TIMEOUT
+		print "Switched to %d baud" % baud
+		return -1
+	
+	def onPing(self):
+		#the link works at the new rate; the AVR restarts flow control with a full window
+		self.baudDeadline = None
+		self.resetCredit()
+		return const.PING
+	
 	def onPrint(self, s):
 		print s
 		return -1
 	
+	def onBeginFrame(self, records):
+		#a frame may arrive in several BEGIN_FRAME chunks; hold them until END_FRAME
+		self.frameOpen = True
+		self.frameRecords.extend(records)
+		return -1
+	
+	def onEndFrame(self):
+		records, self.frameRecords = self.frameRecords, []
+		camera, self.pendingCamera = self.pendingCamera, None
+		self.frameOpen = False
+		
+		#everything received since BEGIN_FRAME reaches the render thread together
+		self.post(self.applyFrame, (records, camera))
+		self.publish()
+		return -1
+	
+	def applyFrame(self, records, camera):
+		if camera is not None:
+			AVRSprite.setCamera(*camera)
+		for handle, mask, fields in records:
+			if handle in self.failedHandles:
+				continue
+			if handle not in AVRSprite.spriteList:
+				#the rest of the frame still applies; one stale handle shouldn't drop it
+				print "applyFrame: Unknown handle %d" % handle
+				continue
+			s = AVRSprite.spriteList[handle]
+			if mask & const.FIELD_DELTA:
+				#position and angle are relative to the last values received
+				if mask & const.FIELD_POS:
+					dx, dy = fields[const.FIELD_POS]
+					s.setPos(((s.sentPos[0] + dx) & 0xFFFF, (s.sentPos[1] + dy) & 0xFFFF))
+				if mask & const.FIELD_ROT:
+					s.setAngle((s.sentAngle + fields[const.FIELD_ROT]) & 0xFFFF)
+			else:
+				if mask & const.FIELD_POS:
+					s.setPos(fields[const.FIELD_POS])
+				if mask & const.FIELD_ROT:
+					s.setAngle(fields[const.FIELD_ROT])
+			if mask & const.FIELD_SIZE:
+				s.setSize(fields[const.FIELD_SIZE])
+			if mask & const.FIELD_DEPTH:
+				s.setOrder(fields[const.FIELD_DEPTH])
+			if mask & const.FIELD_VELOCITY:
+				s.setVelocity(fields[const.FIELD_VELOCITY])
+			if mask & const.FIELD_ANGULAR_VEL:
+				s.setAngularVelocity(fields[const.FIELD_ANGULAR_VEL])
+			if mask & const.FIELD_VISIBLE:
+				s.setVisible(fields[const.FIELD_VISIBLE])
+		return -1
+	
+	def fill(self):
+		#blocks until at least one more byte is buffered, then takes everything else waiting
+		if not self.frameOpen:
+			#nothing should wait on the link to reach the screen
+			self.publish()
+		if self.rxStart > self.counted:
+			#noise skipped since the last packet
+			self.grantCredit(self.rxStart - self.counted)
+		del self.rxBuffer[:self.rxStart]
+		self.rxStart = 0
+		self.counted = 0
+		while True:
+			d = self.sensor.read(max(1, self.sensor.inWaiting()))
+			if d:
+				self.rxBuffer.extend(d)
+				return
+			if self.flowActive:
+				#the link is idle; repeat the count in case the last credit record was lost
+				self.sendCredit()
+			if self.baudDeadline is not None and time.time() > self.baudDeadline:
+				#no PING made it through, so the AVR has gone back to the default rate
+				print "Baud switch failed, back to %d baud" % const.BAUD_RATE
+				self.sensor.baudrate = const.BAUD_RATE
+				self.baudDeadline = None
+				self.resetCredit()
+				del self.rxBuffer[:]
+	
+	def readPacket(self):
+		#returns the payload of the next packet with a good CRC. A bad packet is dropped and the
+		#search for PACKET_SYNC resumes just after its sync byte, so one corrupt byte costs one packet
+		while True:
+			start = self.rxBuffer.find(AVRInterface.sync, self.rxStart)
+			if start < 0:
+				#nothing but noise buffered
+				self.rxStart = len(self.rxBuffer)
+				self.fill()
+				continue
+			self.rxStart = start
+			if len(self.rxBuffer) < start + 2:
+				self.fill()
+				continue
+			length = self.rxBuffer[start + 1]
+			if length > const.PACKET_PAYLOAD_MAX:
+				#waiting for a packet this long would hold up every good packet behind it
+				print "Dropped packet: bad length"
+				self.rxStart = start + 1
+				self.sendStatus(const.STATUS_PACKET_DROPPED, 0)
+				continue
+			end = start + 2 + length
+			if len(self.rxBuffer) < end + 2:
+				self.fill()
+				continue
+			
+			crc = (self.rxBuffer[end] << 8) | self.rxBuffer[end + 1]
+			if binascii.crc_hqx(buffer(self.rxBuffer, start + 1, length + 1), 0) == crc:
+				self.rxStart = end + 2
+				self.grantCredit(self.rxStart - self.counted)
+				self.counted = self.rxStart
+				return self.rxBuffer[start + 2:end]
+			
+			print "Dropped packet: bad CRC"
+			self.rxStart = start + 1
+			#deltas in the dropped packet are lost; the AVR resends full transforms
+			self.sendStatus(const.STATUS_PACKET_DROPPED, 0)
+	
+	def nextPacket(self):
+		#payload of the next command, from the board or from a replayed log
+		if self.replay is not None:
+			return self.readLogged()
+		payload = self.readPacket()
+		if self.capture is not None:
+			record = struct.pack(const.CAPTURE_RECORD, time.time() - self.clockStart, len(payload))
+			self.capture.write(record + str(payload))
+		return payload
+	
+	def readLogged(self):
+		header = self.replay.read(struct.calcsize(const.CAPTURE_RECORD))
+		if len(header) < struct.calcsize(const.CAPTURE_RECORD):
+			self.endReplay()
+			return bytearray()
+		stamp, length = struct.unpack(const.CAPTURE_RECORD, header)
+		payload = bytearray(self.replay.read(length))
+		
+		if not self.replayFast:
+			#keep the recorded pacing between packets
+			delay = self.clockStart + stamp - time.time()
+			if delay > 0:
+				time.sleep(delay)
+		self.replayed += 1
+		return payload
+	
+	def endReplay(self):
+		elapsed = max(time.time() - self.clockStart, 0.001)
+		print "Replayed %d packets in %.2f s (%.0f packets/s), %d render passes (%.1f/s)" % (
+			self.replayed, elapsed, self.replayed / elapsed, self.renderPasses, self.renderPasses / elapsed)
+		self.replay.close()
+		self.replay = None
+		self.running = False
+	
+	def grantCredit(self, count):
+		#the AVR sends at most its window beyond the last count it received, so reporting the
+		#running total means a lost credit record only delays the next one rather than shrinking the window
+		self.consumed = (self.consumed + count) & 0xFFFF
+		if (self.consumed - self.reported) & 0xFFFF >= const.CREDIT_BATCH:
+			self.sendCredit()
+	
+	def sendCredit(self):
+		if self.flowActive:
+			self.sendStatus(const.STATUS_CREDIT, self.consumed >> 8, self.consumed)
+			self.reported = self.consumed
+	
+	def resetCredit(self):
+		#both ends count from zero each time the AVR enables flow control
+		self.consumed = 0
+		self.reported = 0
+	
+	def readStruct(self, format):
+		#unpack fixed-size fields at the read offset of the current packet
+		try:
+			values = format.unpack_from(self.payload, self.offset)
+		except struct.error:
+			raise AVRInterface.exception('truncated packet')
+		self.offset += format.size
+		return values
+	
+	def readInt(self, arg):
+		return self.readStruct(AVRInterface.fixedTypes[arg])[0]
+	
+	def readList(self, types):
+		records = []
+		for i in range(self.readInt(INT8)):
+			records.append([self.readArg(arg) for arg in types])
+		return records
+	
+	def readArg(self, arg):
+		if arg == const.STRING:
+			end = self.payload.find('\0', self.offset)
+			if end < 0:
+				raise AVRInterface.exception('truncated packet')
+			data = str(self.payload[self.offset:end])
+			self.offset = end + 1
+			return data
+		elif isinstance(arg, tuple) and arg[0] == const.LIST:
+			return self.readList(arg[1])
+		elif arg == const.FRAME:
+			return self.readFrame()
+		elif arg == const.SVARINT:
+			return self.readVarint()
+		else:
+			return self.readInt(arg)
+	
+	def readVarint(self):
+		#zigzag encoded, little-endian base-128
+		value, shift = 0, 0
+		while True:
+			b = self.readInt(INT8)
+			value |= (b & 0x7F) << shift
+			shift += 7
+			if not b & 0x80:
+				break
+		return (value >> 1) ^ -(value & 1)
+	
+	def readFrame(self):
+		#count, then (handle, field mask, fields present in the mask) per record
+		records = []
+		for i in range(self.readInt(INT8)):
+			handle, mask = self.readStruct(AVRInterface.recordHeader)
+			fields = {}
+			if mask & const.FIELD_DELTA:
+				if mask & const.FIELD_POS:
+					fields[const.FIELD_POS] = (self.readVarint(), self.readVarint())
+				if mask & const.FIELD_ROT:
+					fields[const.FIELD_ROT] = self.readVarint()
+			else:
+				if mask & const.FIELD_POS:
+					fields[const.FIELD_POS] = self.readStruct(AVRInterface.pair)
+				if mask & const.FIELD_ROT:
+					fields[const.FIELD_ROT] = self.readInt(INT16)
+			if mask & const.FIELD_SIZE:
+				fields[const.FIELD_SIZE] = self.readStruct(AVRInterface.pair)
+			if mask & const.FIELD_DEPTH:
+				fields[const.FIELD_DEPTH] = self.readInt(INT8)
+			if mask & const.FIELD_VELOCITY:
+				fields[const.FIELD_VELOCITY] = self.readStruct(AVRInterface.signedPair)
+			if mask & const.FIELD_ANGULAR_VEL:
+				fields[const.FIELD_ANGULAR_VEL] = self.readInt(SINT16)
+			if mask & const.FIELD_VISIBLE:
+				fields[const.FIELD_VISIBLE] = self.readInt(INT8)
+			records.append((handle, mask, fields))
+		return records
+	
 	def pollAVR(self):
         #read garbage bit from board to sync
-		self.sensor.read(1)
+		if self.replay is None:
+			self.sensor.read(1)
 
 		while (self.running):
-			command = self.sensor.read(1)
-			if len(command) != 1:
+			#outside a frame, commands are published once the link goes quiet or PUBLISH_INTERVAL passes
+			if not self.frameOpen and (self.rxStart >= len(self.rxBuffer) or time.time() >= self.publishAt):
+				self.publish()
+			
+			#each packet carries exactly one command
+			self.payload = self.nextPacket()
+			if not self.payload:
 				continue
-			command = ord(command)
-			#print command
-			#print command
+			command = self.payload[0]
+			self.offset = 1
 			if command not in self.mapping:
 				print "Command %s not recognized!" % command
-				self.running = False
-				return
-				
-			args = []
-			for arg in self.mapping[command][1]:
-				if arg == const.STRING:
-					data = ''
-					while True:
-						d = self.sensor.read(1)
-						print "got: " + str(d)
-						if len(d) != 1:
-							continue
-						if ord(d[0]) == 0x00:
-							break
-						data += d[0]
-					args.append(data)
-				else:
-					#read in 1 byte at a time and convert to appropriate sized integer
-					data = []
-					while len(data) != arg:
-						d = self.sensor.read(1)
-						print "got: " + str(d)
-						if len(d) == 1:
-							data.extend(d)
-					arg = 0
-					#receive high byte first, process low byte first
-					data.reverse()
-					for i, b in enumerate(data):
-						arg |= (ord(b) << (i*8)) & (0xff << i*8)
-					args.append(arg)	
+				continue
+			
+			#a packet that made it through the CRC but still cannot be handled is skipped,
+			#since earlier dropped packets can leave handles unknown
 			try:
-				result = self.mapping[command][0](*args)
+				if command in self.formats:
+					args = self.readStruct(self.formats[command])
+				else:
+					args = [self.readArg(arg) for arg in self.mapping[command][1]]
+				if self.debug:
+					print "got: 0x%02X %s" % (command, args)
+				handler = self.mapping[command][0]
+				if command in self.linkCommands:
+					result = handler(*args)
+				elif command in self.queryCommands:
+					result = self.ask(handler, args)
+				else:
+					self.post(handler, args)
+					result = -1
 			except AVRInterface.exception as e:
 				print "Exception:", e
-				self.running = False
-				sys.exit()
-				
-			if isinstance(result, list):
-				for r in result:
-					self.sensor.write(chr(r & 0xff))
-				self.sensor.write(chr(0xff))
+				continue
+			
+
+			if isinstance(result, tuple):
+				#a batch of hit lists, each terminated like a single list
+				self.send(''.join(''.join(chr(r & 0xff) for r in hits) + chr(0xff) for hits in result))
+			elif isinstance(result, list):
+				self.send(''.join(chr(r & 0xff) for r in result) + chr(0xff))
 			else:
 				if result != -1:
-					self.sensor.write(chr(result & 0xff))
+					self.send(chr(result & 0xff))
 					
 if __name__ == '__main__':
 	AVRInterface()
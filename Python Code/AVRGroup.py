@@ -13,7 +13,7 @@ import AVRConstants as const
 import AVRSprite
 
 class AVRGroup(object):
-	availableHandles = [i for i in range(0xFE)]
+	availableHandles = [i for i in range(const.ALL_GROUP + 1, 0xFE)]
 	groupList = {}
 	
 	def __init__(self, handle=None):
@@ -23,7 +23,7 @@ class AVRGroup(object):
 			return
 
 		if handle == None:
-			self.handle = AVRSprite.AVRSprite.availableHandles.pop()
+			self.handle = AVRGroup.availableHandles.pop()
 		else:
 			self.handle = const.ALL_GROUP
 		AVRGroup.groupList[self.handle] = self
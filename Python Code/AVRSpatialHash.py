@@ -0,0 +1,66 @@
+############################################
+#
+# AVRSpatialHash.py
+#
+# Code provided as is.  Use and Modify at your own risk.
+# Packaged and tested using python2.7 32 bit, pygame 1.9.1, pySerial 2.6
+#
+############################################
+
+import AVRConstants as const
+
+class AVRSpatialHash(object):
+	'''Uniform grid over the window. Each drawn sprite is filed under every cell its
+	rect touches, so a collision query only looks at sprites in the cells it overlaps
+	rather than at every sprite in a group.'''
+	cells = {}					#(column, row) -> set of pygame sprites touching the cell
+	spans = {}					#pygame sprite -> (first column, first row, last column, last row)
+	cellSize = const.SPATIAL_CELL_SIZE
+	
+	@staticmethod
+	def span(rect):
+		size = AVRSpatialHash.cellSize
+		#right and bottom are exclusive
+		return (rect.left // size, rect.top // size,
+			(rect.right - 1) // size, (rect.bottom - 1) // size)
+	
+	@staticmethod
+	def move(s):
+		#file a sprite under the cells of its current rect; cheap when it stays in the same cells
+		span = AVRSpatialHash.span(s.rect)
+		old = AVRSpatialHash.spans.get(s)
+		if old == span:
+			return
+		if old is not None:
+			AVRSpatialHash.unfile(s, old)
+		AVRSpatialHash.spans[s] = span
+		for cell in AVRSpatialHash.cellsIn(span):
+			AVRSpatialHash.cells.setdefault(cell, set()).add(s)
+	
+	@staticmethod
+	def remove(s):
+		old = AVRSpatialHash.spans.pop(s, None)
+		if old is not None:
+			AVRSpatialHash.unfile(s, old)
+	
+	@staticmethod
+	def query(rect):
+		#every sprite filed under a cell the rect touches; callers still test the rects
+		found = set()
+		for cell in AVRSpatialHash.cellsIn(AVRSpatialHash.span(rect)):
+			if cell in AVRSpatialHash.cells:
+				found.update(AVRSpatialHash.cells[cell])
+		return found
+	
+	@staticmethod
+	def unfile(s, span):
+		for cell in AVRSpatialHash.cellsIn(span):
+			sprites = AVRSpatialHash.cells[cell]
+			sprites.discard(s)
+			if not sprites:
+				del AVRSpatialHash.cells[cell]
+	
+	@staticmethod
+	def cellsIn(span):
+		left, top, right, bottom = span
+		return [(x, y) for x in range(left, right + 1) for y in range(top, bottom + 1)]
@@ -1,7 +1,9 @@
 from pygame import image, error, transform, sprite, mask
 import AVRGroup
 import AVRConstants as const
-from threading import Lock
+from AVRSurfaceCache import AVRSurfaceCache
+from AVRSpatialHash import AVRSpatialHash
+import math
 '''possible to load:
 JPG 
  PNG 
@@ -15,51 +17,64 @@ JPG
  XPM
  '''
 
+#sprites, groups and their pygame state belong to the render thread; the serial thread
+#hands commands over through AVRInterface.publish instead of changing them itself
 class AVRSprite(object):
-	availableHandles = [i for i in range(0xFE)]
+	imageList = {}		#registered image ID -> (filename, decoded surface)
 	spriteList = {}
 	deletedSprites = []
 	spriteDrawGroup = sprite.LayeredDirty()
-	deleteLock = Lock()
-	spriteLock = Lock()
+	camera = (0, 0, 1.0)	#world point at the window's upper-left corner, and zoom
 	
-	def __init__(self, filename, pos, angle, size, order):
+	def __init__(self, handle, image, pos, angle, size, order, surface=None):
 		self.pos = pos
 		self.angle = angle
+		#transform deltas from the AVR are relative to the last values it sent,
+		#not to where the sprite has since moved on its own
+		self.sentPos = pos
+		self.sentAngle = angle
+		self.exactPos = [float(pos[0]), float(pos[1])]
+		self.exactAngle = float(angle)
+		self.velocity = (0, 0)			#pixels per second
+		self.angularVelocity = 0		#degrees per second CCW
 		self.size = size[:]	#copy	
 		self.order = order
-		self.filename = filename
+		self.image = image
+		self.baseImage = image			#frame 0; SET_FRAME counts from here
+		if surface is None:
+			self.filename, self.surface = AVRSprite.imageList[image]
+		else:
+			#drawn by a subclass rather than loaded from a registered image
+			self.filename, self.surface = None, surface
 		self.groups = []
+		self.screenSpace = False		#HUD sprites ignore the camera
+		self.parent = None				#sprite this one follows, set by ATTACH
+		self.offset = (0, 0)			#center relative to the parent's center
+		self.attachFlags = 0
+		self.children = []
 		
-		if len(AVRSprite.availableHandles) == 0:
-			print "ERROR: AVRSprite out of handles!"
-			self.handle = -1
-			return
-		
-		try:
-			self.surface = image.load(self.filename).convert_alpha()
-		except error as e:
-			print "ERROR: Could not load image: '%s'" % self.filename
-			raise e
-		
-		self.scaledSurface = transform.smoothscale(self.surface, self.size)
-		self.transformedSurface = transform.rotate(self.scaledSurface, self.angle)  
+		self.scaledSurface = self.scaledFrame()
+		self.transformedSurface = self.rotatedFrame()
 		
 		self.sprite = sprite.DirtySprite()
 		self.sprite.image = self.transformedSurface
 		self.sprite.rect = self.transformedSurface.get_rect()
-		self.sprite.rect.center = self.pos
+		self.sprite.rect.center = self.screenPos()
 		self.sprite.dirty = 1
 		self.sprite.maskDirty = True
 		self.sprite.AVRSprite = self
+		self.visible = True
+		AVRSpatialHash.move(self.sprite)
 		
 		self.posDirty = False
 		self.rotateDirty = False
 		self.sizeDirty = False
+		self.frameDirty = False
 		
 		AVRSprite.spriteDrawGroup.add(self.sprite, layer=self.order)
 		AVRGroup.AVRGroup.groupList[const.ALL_GROUP].addSprite(self)
-		self.handle = AVRSprite.availableHandles.pop()
+		#handles are allocated by the AVR
+		self.handle = handle
 		AVRSprite.spriteList[self.handle] = self
 		
 		#print 'sprite %s with handle %s' % (self.filename, self.handle)
@@ -70,16 +85,122 @@ class AVRSprite(object):
 		self.sprite.dirty = 1
 	
 	def setPos(self, pos):
+		self.sentPos = pos
+		self.exactPos = [float(pos[0]), float(pos[1])]
+		if pos == self.pos:
+			return
+			
 		self.pos = pos
 		self.posDirty = True
 	
 	def setAngle(self, angle):
+		self.sentAngle = angle
+		self.exactAngle = float(angle)
 		if angle == self.angle:
 			return
 			
 		self.angle = angle
 		self.rotateDirty = True
 	
+	def attach(self, parent, offset, flags):
+		#refuse to attach a sprite beneath itself
+		p = parent
+		while p is not None:
+			if p is self:
+				print "attach: sprite %d is an ancestor of sprite %d" % (self.handle, parent.handle)
+				return
+			p = p.parent
+		
+		self.detach()
+		self.parent = parent
+		self.offset = offset
+		self.attachFlags = flags
+		parent.children.append(self)
+	
+	def detach(self):
+		#the child stays where its parent last put it. sentPos and sentAngle are left alone:
+		#they are what the AVR's next deltas for the child are relative to
+		if self.parent is None:
+			return
+		self.parent.children.remove(self)
+		self.parent = None
+		self.exactPos = [float(self.pos[0]), float(self.pos[1])]
+		self.exactAngle = float(self.angle)
+	
+	def composeChildren(self):
+		#place each child relative to this sprite, then its own children in turn
+		if self.children:
+			a = math.radians(self.angle)
+			cos, sin = math.cos(a), math.sin(a)
+		for c in self.children:
+			dx, dy = c.offset
+			angle = int(round(c.exactAngle)) % 360
+			if c.attachFlags & const.ATTACH_ROTATE:
+				#angles are CCW on a screen whose y-axis points down
+				dx, dy = dx * cos + dy * sin, dy * cos - dx * sin
+				angle = (angle + self.angle) % 360
+			pos = (int(round(self.pos[0] + dx)), int(round(self.pos[1] + dy)))
+			if pos != c.pos:
+				c.pos = pos
+				c.posDirty = True
+			if angle != c.angle:
+				c.angle = angle
+				c.rotateDirty = True
+			c.composeChildren()
+	
+	def setVelocity(self, velocity):
+		self.velocity = velocity
+	
+	def setAngularVelocity(self, rate):
+		self.angularVelocity = rate
+	
+	def setVisible(self, visible):
+		visible = bool(visible)
+		if visible == self.visible:
+			return
+		#a hidden sprite stays in its groups, so pooled sprites can be reused cheaply
+		self.visible = visible
+		self.sprite.visible = 1 if visible else 0
+		self.sprite.dirty = 1
+	
+	def setFrame(self, frame):
+		image = self.baseImage + frame
+		if image not in AVRSprite.imageList:
+			return False
+		if image != self.image:
+			self.image = image
+			self.filename, self.surface = AVRSprite.imageList[image]
+			self.frameDirty = True
+		return True
+	
+	def scaledFrame(self):
+		size = self.viewSize()
+		if self.filename is None:
+			#drawn surfaces change in place, so they are not shared
+			if size == self.surface.get_size():
+				return self.surface
+			return transform.smoothscale(self.surface, size)
+		return AVRSurfaceCache.surface(self.filename, self.surface, size, 0)
+	
+	def rotatedFrame(self):
+		if self.filename is None:
+			return transform.rotate(self.scaledSurface, self.angle)
+		return AVRSurfaceCache.surface(self.filename, self.surface, self.viewSize(), AVRSurfaceCache.quantise(self.angle))
+	
+	def viewSize(self):
+		zoom = 1.0 if self.screenSpace else AVRSprite.camera[2]
+		return (max(int(self.size[0] * zoom), 1), max(int(self.size[1] * zoom), 1))
+	
+	def screenPos(self):
+		if self.screenSpace:
+			return self.pos
+		x, y, zoom = AVRSprite.camera
+		return (int((self.pos[0] - x) * zoom), int((self.pos[1] - y) * zoom))
+	
+	def setScreenSpace(self, screen):
+		self.screenSpace = bool(screen)
+		self.sizeDirty = True
+	
 	def setSize(self, size):
 		if size[0] == self.size[0] and size[1] == self.size[1]:
 			return
@@ -88,42 +209,77 @@ class AVRSprite(object):
 		self.sizeDirty = True
 				
 	def delete(self):
-		#locks required because in order to delete, 
-		#the main thread must clear and then call AVRSprite.onDelete atomically
-		#also, this gaurantees the order of object deletion so no infinite reference loops occur
-		AVRSprite.deleteLock.acquire()
+		#the render loop clears and then calls AVRSprite.onDelete,
+		#which gaurantees the order of object deletion so no infinite reference loops occur
 		AVRSprite.deletedSprites.append(self)
 		self.sprite.dirty = 1
 		for g in self.groups[:]:
 			g.removeSprite(self)
 		self.groups = []
+		for c in self.children[:]:
+			c.detach()
+		self.detach()
+		AVRSpatialHash.remove(self.sprite)
 		
 		self.sprite.AVRSprite = None
 		del AVRSprite.spriteList[self.handle]
-		AVRSprite.availableHandles.append(self.handle)
-		AVRSprite.deleteLock.release()
 	
 	def collide(self, group):
+		if not self.visible:
+			return []
 		if self.sprite.maskDirty:
 			self.sprite.maskDirty = False
-			AVRSprite.spriteLock.acquire()
-			self.sprite.mask = mask.from_surface(self.transformedSurface)
-			AVRSprite.spriteLock.release()
+			self.sprite.mask = self.buildMask()
 		
-		sprites = sprite.spritecollide(self.sprite, group.group, False)
+		#only sprites sharing a grid cell can touch; the rest of the group is never looked at
 		results = []
-		for s in sprites:
-			if s == self.sprite:
+		for s in AVRSpatialHash.query(self.sprite.rect):
+			if s == self.sprite or not s.visible or s not in group.group:
+				continue
+			if not self.sprite.rect.colliderect(s.rect):
 				continue
 			if s.maskDirty:
 				s.maskDirty = False
-				AVRSprite.spriteLock.acquire()
-				s.mask = mask.from_surface(s.AVRSprite.transformedSurface)
-				AVRSprite.spriteLock.release()
+				s.mask = s.AVRSprite.buildMask()
 			if sprite.collide_mask(self.sprite, s) != None:
 				results.append(s.AVRSprite.handle)
+		#the same contacts always come back in the same order
+		results.sort()
 		return results
 	
+	def buildMask(self):
+		#collision shape; every opaque pixel by default
+		if self.filename is None:
+			return mask.from_surface(self.transformedSurface)
+		return AVRSurfaceCache.collisionMask(self.filename, self.surface, self.viewSize(), AVRSurfaceCache.quantise(self.angle))
+	
+	@staticmethod
+	def registerImage(id, filename):
+		#decode once; every sprite created from the ID, or from another ID with the same file, shares the surface
+		for name, surface in AVRSprite.imageList.values():
+			if name == filename:
+				AVRSprite.imageList[id] = (filename, surface)
+				return
+		try:
+			surface = image.load(filename).convert_alpha()
+		except error as e:
+			print "ERROR: Could not load image: '%s'" % filename
+			raise e
+		AVRSprite.imageList[id] = (filename, surface)
+	
+	@staticmethod
+	def registerSheet(id, frames, filename):
+		#split the sheet once; each frame is registered as an image of its own
+		try:
+			sheet = image.load(filename).convert_alpha()
+		except error as e:
+			print "ERROR: Could not load image: '%s'" % filename
+			raise e
+		width, height = sheet.get_width() / frames, sheet.get_height()
+		for i in range(frames):
+			frame = sheet.subsurface((i * width, 0, width, height)).copy()
+			AVRSprite.imageList[id + i] = ('%s[%d]' % (filename, i), frame)
+	
 	@staticmethod
 	def onDelete():
 		for s in AVRSprite.deletedSprites:
@@ -133,32 +289,70 @@ class AVRSprite(object):
 		AVRSprite.deletedSprites = []
 		
 	@staticmethod
-	def update():
+	def setCamera(x, y, zoom):
+		zoomChanged = zoom != AVRSprite.camera[2]
+		AVRSprite.camera = (x, y, zoom)
+		for s in AVRSprite.spriteList.values():
+			if s.screenSpace:
+				continue
+			if zoomChanged:
+				s.sizeDirty = True
+			else:
+				s.posDirty = True
+	
+	@staticmethod
+	def move(dt):
+		#dead reckoning: advance every moving sprite by dt seconds
 		for s in AVRSprite.spriteList.values():
-			if s.posDirty or s.sizeDirty or s.rotateDirty:
-				s.sprite.dirty = 1
+			if s.velocity != (0, 0):
+				s.exactPos[0] += s.velocity[0] * dt
+				s.exactPos[1] += s.velocity[1] * dt
+				pos = (int(round(s.exactPos[0])), int(round(s.exactPos[1])))
+				if pos != s.pos:
+					s.pos = pos
+					s.posDirty = True
+			if s.angularVelocity != 0:
+				s.exactAngle = (s.exactAngle + s.angularVelocity * dt) % 360
+				angle = int(round(s.exactAngle)) % 360
+				if angle != s.angle:
+					s.angle = angle
+					s.rotateDirty = True
+	
+	@staticmethod
+	def compose():
+		#children follow their parents; run after move so they see this pass's positions
+		for s in AVRSprite.spriteList.values():
+			if s.parent is None and s.children:
+				s.composeChildren()
 	
 	@staticmethod
 	def updateGraphics():
+		#only sprites that changed since the last pass are rescaled, rotated or redrawn.
+		#each flag is cleared before the work it stands for, so a change made by the serial
+		#thread meanwhile is picked up now or on the next pass, never lost
 		for s in AVRSprite.spriteList.values():
-			if s.sizeDirty:
-				s.scaledSurface = transform.smoothscale(s.surface, s.size)
-				s.transformedSurface = transform.rotate(s.scaledSurface, s.angle)
+			if not (s.posDirty or s.rotateDirty or s.sizeDirty or s.frameDirty):
+				continue
+			s.sprite.dirty = 1
+			
+			if s.sizeDirty or s.frameDirty:
+				s.sizeDirty = s.frameDirty = s.rotateDirty = s.posDirty = False
+				s.scaledSurface = s.scaledFrame()
+				s.transformedSurface = s.rotatedFrame()
 				s.sprite.image = s.transformedSurface
 				s.sprite.rect = s.transformedSurface.get_rect()
-				s.sprite.rect.center = s.pos
+				s.sprite.rect.center = s.screenPos()
 				s.sprite.maskDirty = True
 				
 			elif s.rotateDirty:
-				s.transformedSurface = transform.rotate(s.scaledSurface, s.angle)
+				s.rotateDirty = s.posDirty = False
+				s.transformedSurface = s.rotatedFrame()
 				s.sprite.image = s.transformedSurface
 				s.sprite.rect = s.transformedSurface.get_rect()
-				s.sprite.rect.center = s.pos
+				s.sprite.rect.center = s.screenPos()
 				s.sprite.maskDirty = True
 				
-			elif s.posDirty:
-				s.sprite.rect.center = s.pos
+			else:
 				s.posDirty = False
-			s.posDirty = True
-			s.rotateDirty = True
-			s.sizeDirty = True
+				s.sprite.rect.center = s.screenPos()
+			AVRSpatialHash.move(s.sprite)
@@ -0,0 +1,71 @@
+############################################
+#
+# AVRSurfaceCache.py
+#
+# Code provided as is.  Use and Modify at your own risk.
+# Packaged and tested using python2.7 32 bit, pygame 1.9.1, pySerial 2.6
+#
+############################################
+
+from pygame import transform, mask
+from collections import OrderedDict
+import AVRConstants as const
+
+class AVRSurfaceCache(object):
+	'''Scaled and rotated surfaces, and their collision masks, shared by every sprite
+	drawn from the same image. Entries are keyed by (filename, size, angle) and the
+	least recently used are dropped once the cache holds more than SURFACE_CACHE_BYTES.'''
+	entries = OrderedDict()		#(filename, size, angle) -> [surface, mask or None, bytes]
+	size = 0					#bytes held by entries
+	limit = const.SURFACE_CACHE_BYTES
+	angleStep = const.ANGLE_STEP
+	
+	@staticmethod
+	def quantise(angle):
+		step = AVRSurfaceCache.angleStep
+		return int(round((angle % 360) / float(step))) * step % 360
+	
+	@staticmethod
+	def surface(filename, source, size, angle):
+		#source scaled to size and rotated CCW by angle, which must already be quantised
+		return AVRSurfaceCache.entry(filename, source, size, angle)[0]
+	
+	@staticmethod
+	def collisionMask(filename, source, size, angle):
+		#built the first time a sprite with this shape is tested for collisions
+		entry = AVRSurfaceCache.entry(filename, source, size, angle)
+		if entry[1] is None:
+			entry[1] = mask.from_surface(entry[0])
+			bits = (entry[0].get_width() * entry[0].get_height()) / 8
+			entry[2] += bits
+			AVRSurfaceCache.size += bits
+			AVRSurfaceCache.trim()
+		return entry[1]
+	
+	@staticmethod
+	def entry(filename, source, size, angle):
+		key = (filename, size, angle)
+		entry = AVRSurfaceCache.entries.pop(key, None)
+		if entry is None:
+			if angle != 0:
+				surface = transform.rotate(AVRSurfaceCache.entry(filename, source, size, 0)[0], angle)
+			elif size != source.get_size():
+				surface = transform.smoothscale(source, size)
+			else:
+				surface = source
+			#the decoded image itself is held by the image list, not the cache
+			cost = 0 if surface is source else surface.get_width() * surface.get_height() * surface.get_bytesize()
+			entry = [surface, None, cost]
+			AVRSurfaceCache.size += cost
+		
+		#most recently used entries live at the end
+		AVRSurfaceCache.entries[key] = entry
+		AVRSurfaceCache.trim()
+		return entry
+	
+	@staticmethod
+	def trim():
+		#the newest entry is always kept, however large
+		while AVRSurfaceCache.size > AVRSurfaceCache.limit and len(AVRSurfaceCache.entries) > 1:
+			key, entry = AVRSurfaceCache.entries.popitem(last=False)
+			AVRSurfaceCache.size -= entry[2]
@@ -0,0 +1,68 @@
+############################################
+#
+# AVRText.py
+#
+# Code provided as is.  Use and Modify at your own risk.
+# Packaged and tested using python2.7 32 bit, pygame 1.9.1, pySerial 2.6
+#
+############################################
+
+from pygame import font, Surface, SRCALPHA
+import AVRConstants as const
+from AVRSprite import AVRSprite
+
+class AVRText(AVRSprite):
+	fonts = {}			#(font index, size) -> loaded pygame font
+	glyphs = {}			#(font index, size, character) -> rendered glyph, shared by every text sprite
+	
+	def __init__(self, handle, fontIndex, fontSize, pos, order):
+		self.fontKey = (fontIndex, fontSize)
+		self.text = ''
+		self.fixedSize = False		#set once vSpriteSetSize gives the text a size of its own
+		surface = self.render(self.text)
+		AVRSprite.__init__(self, handle, None, pos, 0, surface.get_size(), order, surface)
+	
+	def setText(self, text):
+		#only redraw when the string changes
+		if text == self.text:
+			return
+		self.text = text
+		self.surface = self.render(text)
+		if not self.fixedSize:
+			self.size = self.surface.get_size()
+		self.frameDirty = True
+	
+	def setSize(self, size):
+		#the string is stretched to an explicit size from then on, whatever it becomes
+		self.fixedSize = True
+		AVRSprite.setSize(self, size)
+	
+	def setFrame(self, frame):
+		return False
+	
+	def render(self, text):
+		glyphs = [AVRText.glyph(self.fontKey, c) for c in text]
+		width = max(sum(g.get_width() for g in glyphs), 1)
+		height = AVRText.font(self.fontKey).get_linesize()
+		surface = Surface((width, height), SRCALPHA)
+		x = 0
+		for g in glyphs:
+			surface.blit(g, (x, 0))
+			x += g.get_width()
+		return surface
+	
+	@staticmethod
+	def font(key):
+		if key not in AVRText.fonts:
+			fontIndex, fontSize = key
+			if fontIndex >= len(const.FONTS):
+				print "ERROR: Unknown font %d, using the default" % fontIndex
+				fontIndex = 0
+			AVRText.fonts[key] = font.Font(const.FONTS[fontIndex], fontSize)
+		return AVRText.fonts[key]
+	
+	@staticmethod
+	def glyph(key, c):
+		if key + (c,) not in AVRText.glyphs:
+			AVRText.glyphs[key + (c,)] = AVRText.font(key).render(c, True, const.TEXT_COLOR)
+		return AVRText.glyphs[key + (c,)]
@@ -0,0 +1,121 @@
+############################################
+#
+# AVRTilemap.py
+#
+# Code provided as is.  Use and Modify at your own risk.
+# Packaged and tested using python2.7 32 bit, pygame 1.9.1, pySerial 2.6
+#
+############################################
+
+import os, base64, zlib, gzip, StringIO
+from xml.etree import ElementTree
+from pygame import image, mask, transform, Surface, SRCALPHA
+from AVRSprite import AVRSprite
+
+GID_MASK = 0x1FFFFFFF		#the top bits of a gid are Tiled's flip flags
+
+class AVRTilemap(AVRSprite):
+	'''A Tiled .tmx map drawn as one static sprite. Only solid tiles collide.'''
+	
+	def __init__(self, handle, filename, order):
+		root = ElementTree.parse(filename).getroot()
+		if root.get('orientation', 'orthogonal') != 'orthogonal':
+			raise ValueError("only orthogonal maps are supported")
+		self.width, self.height = int(root.get('width')), int(root.get('height'))
+		self.tileWidth, self.tileHeight = int(root.get('tilewidth')), int(root.get('tileheight'))
+		
+		base = os.path.dirname(filename)
+		tilesets = sorted(self.loadTileset(t, base) for t in root.findall('tileset'))
+		
+		pixels = (self.width * self.tileWidth, self.height * self.tileHeight)
+		surface = Surface(pixels, SRCALPHA)
+		walls = Surface(pixels, SRCALPHA)
+		self.solid = [False] * (self.width * self.height)
+		
+		for layer in root.findall('layer'):
+			if layer.get('visible', '1') == '0':
+				continue
+			solidLayer = AVRTilemap.solidProperty(layer)
+			for i, gid in enumerate(AVRTilemap.readLayer(layer)):
+				gid &= GID_MASK
+				if gid == 0:
+					continue
+				tileset = [t for t in tilesets if t[0] <= gid][-1]
+				firstgid, tileImage, columns, tw, th, margin, spacing, solidTiles = tileset
+				tile = gid - firstgid
+				src = (margin + (tile % columns) * (tw + spacing), margin + (tile / columns) * (th + spacing), tw, th)
+				#tiles taller than the grid hang upward from the bottom of their cell, as in Tiled
+				dest = ((i % self.width) * self.tileWidth, (i / self.width + 1) * self.tileHeight - th)
+				surface.blit(tileImage, dest, src)
+				if solidLayer or tile in solidTiles:
+					self.solid[i] = True
+					walls.fill((255, 255, 255, 255), (dest[0], dest[1], tw, th))
+		
+		#the mask is rebuilt from the walls only when the zoom changes the map's size on screen
+		self.walls = walls
+		self.solidMask = mask.from_surface(walls)
+		self.maskSize = pixels
+		center = (pixels[0] / 2, pixels[1] / 2)
+		AVRSprite.__init__(self, handle, None, center, 0, pixels, order, surface)
+	
+	def loadTileset(self, tileset, base):
+		firstgid = int(tileset.get('firstgid'))
+		if tileset.get('source') is not None:
+			#external .tsx; its paths are relative to the .tsx itself
+			path = os.path.join(base, tileset.get('source'))
+			tileset = ElementTree.parse(path).getroot()
+			base = os.path.dirname(path)
+		tw, th = int(tileset.get('tilewidth')), int(tileset.get('tileheight'))
+		margin, spacing = int(tileset.get('margin', 0)), int(tileset.get('spacing', 0))
+		tileImage = image.load(os.path.join(base, tileset.find('image').get('source'))).convert_alpha()
+		columns = max((tileImage.get_width() - 2 * margin + spacing) / (tw + spacing), 1)
+		solidTiles = set(int(t.get('id')) for t in tileset.findall('tile') if AVRTilemap.solidProperty(t))
+		return (firstgid, tileImage, columns, tw, th, margin, spacing, solidTiles)
+	
+	def buildMask(self):
+		#maps are static; the wall mask only has to follow the camera's zoom
+		size = self.viewSize()
+		if size != self.maskSize:
+			self.solidMask = mask.from_surface(transform.scale(self.walls, size))
+			self.maskSize = size
+		return self.solidMask
+	
+	def setFrame(self, frame):
+		return False
+	
+	def solidBits(self):
+		#row by row, seven tiles per byte so no byte can look like a status record
+		bits = []
+		for i in range(0, len(self.solid), 7):
+			b = 0
+			for j, solid in enumerate(self.solid[i:i + 7]):
+				if solid:
+					b |= 1 << j
+			bits.append(b)
+		return bits
+	
+	@staticmethod
+	def solidProperty(element):
+		for p in element.findall('properties/property'):
+			if p.get('name') == 'solid':
+				return p.get('value', '').lower() in ('true', '1')
+		return False
+	
+	@staticmethod
+	def readLayer(layer):
+		#returns the layer's gids, row by row
+		data = layer.find('data')
+		encoding, compression = data.get('encoding'), data.get('compression')
+		if encoding == 'csv':
+			return [int(v) for v in data.text.replace('\n', '').split(',') if v.strip()]
+		if encoding is None:
+			return [int(t.get('gid', 0)) for t in data.findall('tile')]
+		
+		raw = base64.b64decode(data.text.strip())
+		if compression == 'zlib':
+			raw = zlib.decompress(raw)
+		elif compression == 'gzip':
+			raw = gzip.GzipFile(fileobj=StringIO.StringIO(raw)).read()
+		#little-endian 32-bit gids
+		return [ord(raw[i]) | ord(raw[i + 1]) << 8 | ord(raw[i + 2]) << 16 | ord(raw[i + 3]) << 24
+				for i in range(0, len(raw), 4)]